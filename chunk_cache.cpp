@@ -0,0 +1,108 @@
+#include "chunk_cache.hpp"
+
+#include <algorithm>
+
+// Enough for a view of a few hundred hexes across, so a budget that's too
+// small degrades to thrashing instead of evicting chunks in use.
+#define MIN_CHUNKS 64
+
+static int floor_div(int a, int b)
+{
+    int ret = a / b;
+    if ((a % b != 0) && ((a < 0) != (b < 0))) ret--;
+    return ret;
+}
+
+ChunkCache::ChunkCache(const tile_generator *_gen, size_t budget_bytes)
+: gen(_gen)
+, max_chunks(std::max<size_t>(MIN_CHUNKS, budget_bytes / sizeof(Chunk)))
+{
+}
+
+ChunkCache::Key ChunkCache::chunk_of(const HexCoord<int> &hex)
+{
+    return Key(floor_div(hex.q, CHUNK_SIZE), floor_div(hex.r, CHUNK_SIZE));
+}
+
+void ChunkCache::persist_to(const char *dir)
+{
+    store.reset(new ChunkStore(dir, gen, CHUNK_SIZE * CHUNK_SIZE));
+}
+
+void ChunkCache::generate(const Key &key, Chunk &chunk) const
+{
+    if (store && store->load(key.first, key.second,
+                             chunk.values.data(), chunk.values.size())) {
+        return;
+    }
+
+    std::array<float, CHUNK_SIZE * CHUNK_SIZE> xs, ys;
+    for (int i = 0; i < CHUNK_SIZE; i++) {
+        for (int k = 0; k < CHUNK_SIZE; k++) {
+            HexCoord<int> hex = {
+                key.first * CHUNK_SIZE + i,
+                key.second * CHUNK_SIZE + k
+            };
+            Point<double> p = hex_to_pixel(hex);
+            xs[i * CHUNK_SIZE + k] = p.x;
+            ys[i * CHUNK_SIZE + k] = p.y;
+        }
+    }
+    tile_values(gen, xs.data(), ys.data(), chunk.values.data(),
+                chunk.values.size());
+
+    if (store) {
+        store->save(key.first, key.second,
+                    chunk.values.data(), chunk.values.size());
+    }
+}
+
+ChunkCache::Chunk &ChunkCache::load(const Key &key)
+{
+    auto it = chunks.find(key);
+    if (it != chunks.end()) {
+        lru.splice(lru.begin(), lru, it->second.lru);
+        return it->second;
+    }
+
+    if (chunks.size() >= max_chunks) {
+        chunks.erase(lru.back());
+        lru.pop_back();
+    }
+
+    Chunk &chunk = chunks[key];
+    generate(key, chunk);
+    lru.push_front(key);
+    chunk.lru = lru.begin();
+    return chunk;
+}
+
+float ChunkCache::value(const HexCoord<int> &hex)
+{
+    const Key key = chunk_of(hex);
+    const Chunk &chunk = load(key);
+    int i = hex.q - key.first * CHUNK_SIZE;
+    int k = hex.r - key.second * CHUNK_SIZE;
+    return chunk.values[i * CHUNK_SIZE + k];
+}
+
+void ChunkCache::prefetch(const HexCoord<int> &center,
+                          const HexCoord<int> &direction, int extent)
+{
+    HexCoord<int> ahead = {
+        center.q + direction.q * CHUNK_SIZE,
+        center.r + direction.r * CHUNK_SIZE
+    };
+    HexCoord<int> lo = {ahead.q - extent, ahead.r - extent};
+    HexCoord<int> hi = {ahead.q + extent, ahead.r + extent};
+    Key lo_key = chunk_of(lo);
+    Key hi_key = chunk_of(hi);
+
+    for (int q = lo_key.first; q <= hi_key.first; q++) {
+        for (int r = lo_key.second; r <= hi_key.second; r++) {
+            if (!chunks.count(Key(q, r))) {
+                load(Key(q, r));
+            }
+        }
+    }
+}
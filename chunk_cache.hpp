@@ -0,0 +1,59 @@
+#pragma once
+
+#include <array>
+#include <list>
+#include <map>
+#include <memory>
+#include <utility>
+
+extern "C" {
+#include <stddef.h>
+#include <stdint.h>
+#include "tiles.h"
+}
+
+#include "hex.hpp"
+#include "chunk_store.hpp"
+
+// Chunks are CHUNK_SIZE x CHUNK_SIZE squares in axial coordinates
+#define CHUNK_SIZE 32
+
+// Caches tile_value() for the unbounded world in fixed size chunks, evicting
+// the least recently used chunk once the memory budget is spent. Not thread
+// safe: only the terrain worker touches it once it's running.
+class ChunkCache {
+public:
+    ChunkCache(const tile_generator *gen, size_t budget_bytes);
+
+    // Reads and writes generated chunks under dir. Call once the generator
+    // is initialized, since the store is keyed by its parameters.
+    void persist_to(const char *dir);
+
+    float value(const HexCoord<int> &hex);
+
+    // Loads the chunks which a view of radius extent would need after
+    // walking a chunk further in the given direction.
+    void prefetch(const HexCoord<int> &center, const HexCoord<int> &direction,
+                  int extent);
+
+    size_t size() const { return chunks.size(); }
+
+private:
+    typedef std::pair<int, int> Key;
+
+    struct Chunk {
+        std::array<float, CHUNK_SIZE * CHUNK_SIZE> values;
+        std::list<Key>::iterator lru;
+    };
+
+    static Key chunk_of(const HexCoord<int> &hex);
+    Chunk &load(const Key &key);
+    void generate(const Key &key, Chunk &chunk) const;
+
+    const tile_generator *gen;
+    size_t max_chunks;
+    std::map<Key, Chunk> chunks;
+    // Most recently used at the front
+    std::list<Key> lru;
+    std::unique_ptr<ChunkStore> store;
+};
@@ -0,0 +1,208 @@
+#include "chunk_store.hpp"
+
+#include <cstdio>
+#include <cstring>
+
+extern "C" {
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+}
+
+// Bump this whenever the file layout or terrain generation changes
+#define CHUNK_STORE_VERSION 2
+#define CHUNK_STORE_MAGIC "PPRG"
+#define REGION_SLOTS (CHUNK_STORE_REGION * CHUNK_STORE_REGION)
+// The values start on a page boundary after the header and the index
+#define REGION_VALUES_OFFSET 4096
+
+/* Layout: header, then one hash of each slot's values, zero while the slot is
+ * empty, then the slots' values from REGION_VALUES_OFFSET. A slot only counts
+ * when its values still match the hash, so a chunk whose values didn't all
+ * reach the disk, say after a crash, is just generated again. */
+struct RegionHeader {
+    char magic[4];
+    uint32_t version;
+    uint64_t params;
+    int32_t q, r;
+    uint32_t chunk_values;
+    uint32_t pad;
+};
+
+static_assert(sizeof(RegionHeader) + REGION_SLOTS * sizeof(uint64_t)
+              <= REGION_VALUES_OFFSET, "region index doesn't fit");
+
+#define FNV_OFFSET_BASIS 14695981039346656037ULL
+
+// FNV-1a
+static uint64_t hash_bytes(uint64_t h, const void *data, size_t n)
+{
+    const uint8_t *p = (const uint8_t *)data;
+    for (size_t i = 0; i < n; i++) {
+        h ^= p[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+// Everything that changes tile_value() goes into the hash, including the
+// normalization so a change to tiles_init() invalidates old chunks too.
+static uint64_t hash_generator(const tile_generator *gen)
+{
+    uint64_t h = FNV_OFFSET_BASIS;
+    uint32_t version = CHUNK_STORE_VERSION;
+    h = hash_bytes(h, &version, sizeof(version));
+    h = hash_bytes(h, &gen->_seed, sizeof(gen->_seed));
+    h = hash_bytes(h, &gen->feature_size, sizeof(gen->feature_size));
+    h = hash_bytes(h, &gen->num_harmonics, sizeof(gen->num_harmonics));
+    h = hash_bytes(h, gen->harmonics,
+                   gen->num_harmonics * sizeof(gen->harmonics[0]));
+    h = hash_bytes(h, &gen->_offset, sizeof(gen->_offset));
+    h = hash_bytes(h, &gen->_gain, sizeof(gen->_gain));
+    return h;
+}
+
+static bool make_dir(const std::string &path)
+{
+    if (mkdir(path.c_str(), 0755) < 0 && errno != EEXIST) {
+        perror(path.c_str());
+        return false;
+    }
+    return true;
+}
+
+static int floor_div(int a, int b)
+{
+    int ret = a / b;
+    if ((a % b != 0) && ((a < 0) != (b < 0))) ret--;
+    return ret;
+}
+
+ChunkStore::ChunkStore(const char *_dir, const tile_generator *gen,
+                       size_t _chunk_values)
+: params(hash_generator(gen))
+, enabled(false)
+, chunk_values(_chunk_values)
+, region_size(REGION_VALUES_OFFSET +
+              REGION_SLOTS * _chunk_values * sizeof(float))
+{
+    if (!_dir) return;
+
+    char name[32];
+    snprintf(name, sizeof(name), "%016llx", (unsigned long long)params);
+    dir = std::string(_dir) + "/" + name;
+    enabled = make_dir(_dir) && make_dir(dir);
+}
+
+ChunkStore::~ChunkStore()
+{
+    for (auto &pair : regions) {
+        if (pair.second) munmap(pair.second, region_size);
+    }
+}
+
+uint8_t *ChunkStore::map_region(const Key &key) const
+{
+    char name[64];
+    snprintf(name, sizeof(name), "/%d_%d.region", key.first, key.second);
+    const std::string path = dir + name;
+
+    int fd = open(path.c_str(), O_RDWR | O_CREAT, 0644);
+    if (fd < 0) {
+        perror(path.c_str());
+        return NULL;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        close(fd);
+        return NULL;
+    }
+    // A new region is made full size at once; the empty slots stay sparse
+    bool fresh = (size_t)st.st_size != region_size;
+    if (fresh && (ftruncate(fd, 0) < 0 || ftruncate(fd, region_size) < 0)) {
+        perror(path.c_str());
+        close(fd);
+        return NULL;
+    }
+
+    void *p = mmap(NULL, region_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                   fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) {
+        perror(path.c_str());
+        return NULL;
+    }
+
+    RegionHeader *header = (RegionHeader *)p;
+    if (!fresh) {
+        fresh = memcmp(header->magic, CHUNK_STORE_MAGIC, 4) ||
+                header->version != CHUNK_STORE_VERSION ||
+                header->params != params ||
+                header->q != key.first || header->r != key.second ||
+                header->chunk_values != chunk_values;
+    }
+    if (fresh) {
+        // Clearing the index is enough to empty every slot
+        memset(p, 0, REGION_VALUES_OFFSET);
+        memcpy(header->magic, CHUNK_STORE_MAGIC, 4);
+        header->version = CHUNK_STORE_VERSION;
+        header->params = params;
+        header->q = key.first;
+        header->r = key.second;
+        header->chunk_values = chunk_values;
+    }
+    return (uint8_t *)p;
+}
+
+uint8_t *ChunkStore::region(int q, int r, size_t *slot)
+{
+    const Key key(floor_div(q, CHUNK_STORE_REGION),
+                  floor_div(r, CHUNK_STORE_REGION));
+    *slot = (q - key.first * CHUNK_STORE_REGION) * CHUNK_STORE_REGION
+          + (r - key.second * CHUNK_STORE_REGION);
+
+    auto it = regions.find(key);
+    if (it == regions.end()) {
+        it = regions.insert({key, map_region(key)}).first;
+    }
+    return it->second;
+}
+
+bool ChunkStore::load(int q, int r, float *values, size_t count)
+{
+    if (!enabled || count != chunk_values) return false;
+
+    size_t slot;
+    const uint8_t *map = region(q, r, &slot);
+    if (!map) return false;
+
+    const uint64_t hash =
+        ((const uint64_t *)(map + sizeof(RegionHeader)))[slot];
+    const float *stored =
+        (const float *)(map + REGION_VALUES_OFFSET) + slot * chunk_values;
+    const size_t size = chunk_values * sizeof(float);
+    if (!hash || hash_bytes(FNV_OFFSET_BASIS, stored, size) != hash) {
+        return false;
+    }
+    memcpy(values, stored, size);
+    return true;
+}
+
+bool ChunkStore::save(int q, int r, const float *values, size_t count)
+{
+    if (!enabled || count != chunk_values) return false;
+
+    size_t slot;
+    uint8_t *map = region(q, r, &slot);
+    if (!map) return false;
+
+    const size_t size = chunk_values * sizeof(float);
+    memcpy((float *)(map + REGION_VALUES_OFFSET) + slot * chunk_values,
+           values, size);
+    ((uint64_t *)(map + sizeof(RegionHeader)))[slot] =
+        hash_bytes(FNV_OFFSET_BASIS, values, size);
+    return true;
+}
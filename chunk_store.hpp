@@ -0,0 +1,50 @@
+#pragma once
+
+#include <map>
+#include <string>
+#include <utility>
+
+extern "C" {
+#include <stddef.h>
+#include <stdint.h>
+#include "tiles.h"
+}
+
+// Persists generated chunks under dir/<generator hash>/ in region files of
+// CHUNK_STORE_REGION x CHUNK_STORE_REGION chunks each. A region file is mapped
+// once, the first time one of its chunks is asked for, and chunks are copied
+// in and out of the mapping after that. Every region carries a header with
+// the format version, the generator hash and its coordinate, so files written
+// by a different version or generator are started over. Every generator
+// keeps its own directory, so switching back to one finds its chunks still
+// there; make clean removes them all. Not thread safe.
+#define CHUNK_STORE_REGION 16
+
+class ChunkStore {
+public:
+    // chunk_values is the number of floats in every chunk
+    ChunkStore(const char *dir, const tile_generator *gen,
+               size_t chunk_values);
+    ~ChunkStore();
+    ChunkStore(const ChunkStore &) = delete;
+    ChunkStore &operator=(const ChunkStore &) = delete;
+
+    // Both return false on any failure; the caller just generates the chunk
+    bool load(int q, int r, float *values, size_t count);
+    bool save(int q, int r, const float *values, size_t count);
+
+private:
+    typedef std::pair<int, int> Key;
+
+    // The mapping of the region holding chunk (q, r), or NULL
+    uint8_t *region(int q, int r, size_t *slot);
+    uint8_t *map_region(const Key &key) const;
+
+    uint64_t params;
+    std::string dir;
+    bool enabled;
+    size_t chunk_values;
+    size_t region_size;
+    // NULL for regions that couldn't be mapped, so they aren't retried
+    std::map<Key, uint8_t *> regions;
+};
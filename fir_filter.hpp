@@ -2,56 +2,127 @@
  * GPLv3 License: respect Stallman because he is right.
  */
 
-/* TODO This is wildly inefficient thanks in advance
- */
 #pragma once
-#include <vector>
-#include <list>
+#include <array>
 #include <cmath>
+#include <cstddef>
+#include <utility>
+
+namespace fir_design {
+
+constexpr double PI = 3.14159265358979323846;
+
+// Taylor series after reducing to [-pi, pi], since std::sin isn't constexpr
+constexpr double sin(double x)
+{
+    long long turns = (long long)(x / (2 * PI) + (x < 0 ? -0.5 : 0.5));
+    x -= turns * 2 * PI;
+    double term = x, sum = x;
+    for (int i = 1; i < 20; i++) {
+        term *= -x * x / ((2 * i) * (2 * i + 1));
+        sum += term;
+    }
+    return sum;
+}
+
+constexpr double cos(double x)
+{
+    return sin(x + PI / 2);
+}
+
+constexpr double sinc(double x)
+{
+    return x == 0 ? 1 : sin(PI * x) / (PI * x);
+}
+
+// Tap i of an n tap Hamming windowed sinc lowpass, before scaling
+constexpr double tap(size_t n, double cutoff, size_t i)
+{
+    double m = i - 0.5 * (n - 1);
+    double window = 0.54 - 0.46 * cos(2 * PI * i / (n - 1));
+    return cutoff * sinc(cutoff * m) * window;
+}
+
+constexpr double gain(size_t n, double cutoff)
+{
+    double sum = 0;
+    for (size_t i = 0; i < n; i++) sum += tap(n, cutoff, i);
+    return 1 / sum;
+}
 
-template<typename T>
+template<size_t N, size_t... I>
+constexpr std::array<float, N> firwin(double cutoff, std::index_sequence<I...>)
+{
+    return {{ (float)(tap(N, cutoff, I) * gain(N, cutoff))... }};
+}
+
+} // namespace fir_design
+
+/* scipy.signal.firwin(N, cutoff) at compile time: a lowpass with a Hamming
+ * window and unity gain at DC, with cutoff relative to Nyquist.
+ */
+template<size_t N>
+constexpr std::array<float, N> firwin(double cutoff)
+{
+    return fir_design::firwin<N>(cutoff, std::make_index_sequence<N>());
+}
+
+/* Direct form FIR over the last N inputs. The history is stored twice over
+ * so the window starting at any sample is contiguous, and with N known at
+ * compile time the inner loop has a fixed trip count. The coefficients are
+ * used as given, so they should sum to 1 as firwin's do. It counts samples,
+ * not time, so next()'s dt is only there to match spring_filter.
+ */
+template<typename T, size_t N>
 class fir_filter {
-    std::vector<float> coeff;
-    std::list<T> state;
+    std::array<float, N> coeff;
+    // Newest first from history[newest]
+    std::array<T, 2 * N> history;
+    size_t newest = 0;
+    T output;
 
 public:
-    fir_filter(const std::vector<float> _coeff, const T &initial_value)
+    typedef std::array<float, N> params_type;
+
+    fir_filter(const std::array<float, N> &_coeff, const T &initial_value)
     : coeff(_coeff)
-    , state(coeff.size())
+    , output(initial_value)
     {
-        float sum = 0;
-        for (float c : coeff) sum += c;
-        float gain = 1/sum;
-        for (float &c : coeff) c *= gain;
-        for (unsigned i = 0; i < coeff.size(); i++)
-            next(initial_value);
+        history.fill(initial_value);
     }
 
     T next(const T &x) {
-        int i = 0;
-        for (T &v : state) {
-            v += coeff[i++] * x;
+        newest = newest == 0 ? N - 1 : newest - 1;
+        history[newest] = x;
+        history[newest + N] = x;
+
+        const T *window = &history[newest];
+        T ret = coeff[0] * window[0];
+        for (size_t i = 1; i < N; i++) {
+            ret += coeff[i] * window[i];
         }
-        state.push_back(T());
-        T ret = state.front();
-        state.pop_front();
+        output = ret;
         return ret;
     }
 
-    T get() const { return state.front(); }
+    T next(const T &x, float) { return next(x); }
+
+    T get() const { return output; }
 };
 
-template<typename T>
+// A value clamped to [lil, big] which get() follows through Filter, either a
+// fir_filter or a spring_filter
+template<typename T, typename Filter>
 class filtered_value {
     T big, lil, final_value;
-    fir_filter<T> filter;
+    Filter filter;
 public:
-    filtered_value(const std::vector<float> &filter_coeffs,
+    filtered_value(const typename Filter::params_type &filter_params,
                    const T &_big=INFINITY, const T &_lil=-INFINITY)
     : big(_big)
     , lil(_lil)
-    , final_value(isinf(big) || isinf(lil) ? 0 : (big + lil) / 2.0)
-    , filter(filter_coeffs, final_value)
+    , final_value(std::isinf(big) || std::isinf(lil) ? 0 : (big + lil) / 2.0)
+    , filter(filter_params, final_value)
     {
     }
 
@@ -72,8 +143,8 @@ public:
             final_value = std::max(lil, final_value);
     }
 
-    void step() {
-        filter.next(final_value);
+    void step(float dt) {
+        filter.next(final_value, dt);
     }
 
     T get() const { return filter.get(); }
@@ -30,6 +30,14 @@ void Uniform<glm::mat3>::set(const glm::mat3 &value) const
     check_gl_error();
 }
 
+template<>
+void Uniform<std::vector<glm::vec2>>::set(const std::vector<glm::vec2> &value) const
+{
+    assert(location != UINT_MAX);
+    glUniform2fv(location, value.size(), glm::value_ptr(value[0]));
+    check_gl_error();
+}
+
 template<>
 void Uniform<std::vector<glm::vec3>>::set(const std::vector<glm::vec3> &value) const
 {
@@ -71,14 +79,19 @@ int gl3_material::activate(int index) const
 
 void gl3_group::init(const wf_group& wf)
 {
-    assert(sizeof wf.triangle_indices[0] == 4);
+    init(wf.triangle_indices.data(), wf.triangle_indices.size());
+}
+
+void gl3_group::init(const unsigned *triangle_indices, size_t _count)
+{
+    assert(sizeof triangle_indices[0] == 4);
     glGenBuffers(1, &index_buffer);
-    count = wf.triangle_indices.size();
+    count = _count;
 
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, index_buffer);
     glBufferData(GL_ELEMENT_ARRAY_BUFFER,
                  count * 4,
-                 &wf.triangle_indices[0], GL_STATIC_DRAW);
+                 triangle_indices, GL_STATIC_DRAW);
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
     check_gl_error();
 }
@@ -118,21 +131,25 @@ void VertexArrayObject::unbind()
 
 void gl3_mesh::init(const wf_mesh& wf)
 {
-    vertex_buffer.init(wf.vertex4, true);
-    normal_buffer.init(wf.normal3, wf.has_normals());
-    uv_buffer.init(wf.texture2, wf.has_texture_coords());
-
-    assert(sizeof wf.vertex4[0] == 4);
-    assert(sizeof wf.normal3[0] == 4);
-    assert(sizeof wf.texture2[0] == 4);
-
-    for (const auto &pair : wf.groups) {
-        if (pair.second.size() != 1) {
-            fprintf(stderr, "Not supporting Wavefront groups of size %lu\n",
-                    pair.second.size());
+    init(wf_mesh_view::of(wf));
+}
+
+void gl3_mesh::init(const wf_mesh_view& wf)
+{
+    // Cached meshes are uploaded straight from the mapping
+    if (wf.packed) {
+        vertex_buffer.init(wf.packed, wf.vertex4_count / 4, true);
+    } else {
+        vertex_buffer.init(wf_pack_vertices(wf), true);
+    }
+
+    for (const auto &group : wf.groups) {
+        if (groups.count(group.name)) {
+            fprintf(stderr, "Not supporting Wavefront groups with more than "
+                            "one material: %s\n", group.name.c_str());
             abort();
         }
-        groups[pair.first].init(pair.second[0]);
+        groups[group.name].init(group.triangle_indices, group.count);
     }
 
     check_gl_error();
@@ -144,6 +161,17 @@ void VertexAttribArray::init(GLuint program, const char *name, int _size)
     size = _size;
 }
 
+void VertexAttribArray::init(GLuint program, const char *name, int _size,
+                             GLenum _type, bool _normalized, size_t _stride,
+                             size_t _field_offset)
+{
+    init(program, name, _size);
+    type = _type;
+    normalized = _normalized;
+    stride = _stride;
+    field_offset = _field_offset;
+}
+
 void VertexAttribArray::disable(const ArrayBufferBase &ab) const
 {
     if (!ab.present) return;
@@ -152,12 +180,19 @@ void VertexAttribArray::disable(const ArrayBufferBase &ab) const
     check_gl_error();
 }
 
-void VertexAttribArray::point_to(const ArrayBufferBase &ab) const
+void VertexAttribArray::point_to(const ArrayBufferBase &ab, size_t offset) const
 {
     if (!ab.present) return;
     glEnableVertexAttribArray(location);
     glBindBuffer(GL_ARRAY_BUFFER, ab.buffer);
-    glVertexAttribPointer(location, size, GL_FLOAT, GL_FALSE, 0, NULL);
+    if (integer) {
+        glVertexAttribIPointer(location, size, type, stride,
+                               (void*)(offset + field_offset));
+    }
+    else {
+        glVertexAttribPointer(location, size, type, normalized, stride,
+                              (void*)(offset + field_offset));
+    }
     if (instanced) {
         glVertexAttribDivisor(location, 1);
     }
@@ -170,7 +205,7 @@ void VertexAttribArrayMat4::init(GLuint program, const char *name)
     location0 = get_attrib_location(program, name);
 }
 
-void VertexAttribArrayMat4::disable(const ArrayBuffer<glm::mat4> &ab) const
+void VertexAttribArrayMat4::disable(const ArrayBufferBase &ab) const
 {
     if (!ab.present) return;
     check_gl_error();
@@ -181,7 +216,7 @@ void VertexAttribArrayMat4::disable(const ArrayBuffer<glm::mat4> &ab) const
     check_gl_error();
 }
 
-void VertexAttribArrayMat4::point_to(const ArrayBuffer<glm::mat4> &ab) const
+void VertexAttribArrayMat4::point_to(const ArrayBufferBase &ab, size_t offset) const
 {
     if (!ab.present) return;
     glBindBuffer(GL_ARRAY_BUFFER, ab.buffer);
@@ -191,7 +226,7 @@ void VertexAttribArrayMat4::point_to(const ArrayBuffer<glm::mat4> &ab) const
         glEnableVertexAttribArray(location);
         glVertexAttribPointer(location, 4, GL_FLOAT, GL_FALSE,
                               4 * sizeof(glm::vec4),
-                              (void*)(col * sizeof(glm::vec4)));
+                              (void*)(offset + col * sizeof(glm::vec4)));
         if (instanced) {
             glVertexAttribDivisor(location, 1);
         }
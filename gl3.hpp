@@ -1,8 +1,10 @@
 #pragma once
 
+#include <cstdint>
 #include <string>
 #include <map>
 #include <vector>
+#include <algorithm>
 
 #include <GL/glew.h>
 #define GLM_FORCE_RADIANS
@@ -29,6 +31,7 @@ struct Uniform {
 
 typedef Uniform<glm::mat4> UniformMat4;
 typedef Uniform<glm::mat3> UniformMat3;
+typedef Uniform<std::vector<glm::vec2>> UniformVec2Vec;
 typedef Uniform<std::vector<glm::vec3>> UniformVec3Vec;
 typedef Uniform<int> UniformInt;
 typedef Uniform<float> UniformFloat;
@@ -41,11 +44,18 @@ struct ArrayBufferBase {
 template <typename T>
 struct ArrayBuffer : ArrayBufferBase {
     void init(const std::vector<T> &data, bool _present)
+    {
+        init(data.data(), data.size(), _present);
+    }
+
+    void init(const T *data, size_t count, bool _present)
     {
         present = _present;
         if (present) {
             glGenBuffers(1, &buffer);
-            buffer_data_static(data);
+            glBindBuffer(GL_ARRAY_BUFFER, buffer);
+            glBufferData(GL_ARRAY_BUFFER, sizeof(T) * count, data,
+                         GL_STATIC_DRAW);
         }
     }
 
@@ -63,24 +73,134 @@ struct ArrayBuffer : ArrayBufferBase {
     {
         glBindBuffer(GL_ARRAY_BUFFER, buffer);
         glBufferData(GL_ARRAY_BUFFER,
-                     sizeof(data[0]) * data.size(),
-                     &data[0], usage);
+                     sizeof(T) * data.size(),
+                     data.data(), usage);
+    }
+};
+
+#define STREAM_FRAMES 3
+
+/* Instance data which is rewritten every frame. The buffer is split into
+ * STREAM_FRAMES regions used round robin, and fence() after a frame's draws
+ * keeps map() from handing out a region the GPU may still be reading. With
+ * ARB_buffer_storage the buffer stays mapped persistently and coherently, so
+ * map() is just pointer math. Otherwise each region is mapped for the frame,
+ * unsynchronized because the fence already did the waiting. Attributes have to
+ * be pointed at offset after every map().
+ */
+template <typename T>
+struct StreamingArrayBuffer : ArrayBufferBase {
+    size_t offset = 0;
+
+    void init(size_t initial_capacity)
+    {
+        persistent = GLEW_ARB_buffer_storage;
+        grow(initial_capacity);
+    }
+
+    T *map(size_t count)
+    {
+        region = (region + 1) % STREAM_FRAMES;
+        wait(region);
+        if (count > capacity) {
+            grow(count + count / 2);
+        }
+        offset = region * capacity * sizeof(T);
+        if (persistent) {
+            return mapped + region * capacity;
+        }
+
+        glBindBuffer(GL_ARRAY_BUFFER, buffer);
+        void *ret = glMapBufferRange(GL_ARRAY_BUFFER, offset,
+            std::max<size_t>(count, 1) * sizeof(T),
+            GL_MAP_WRITE_BIT | GL_MAP_UNSYNCHRONIZED_BIT |
+            GL_MAP_INVALIDATE_RANGE_BIT);
+        check_gl_error();
+        return (T *)ret;
+    }
+
+    void unmap()
+    {
+        if (persistent) return;
+        glBindBuffer(GL_ARRAY_BUFFER, buffer);
+        glUnmapBuffer(GL_ARRAY_BUFFER);
     }
+
+    void fence()
+    {
+        if (fences[region]) glDeleteSync(fences[region]);
+        fences[region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    }
+
+private:
+    void wait(int i)
+    {
+        if (!fences[i]) return;
+        while (glClientWaitSync(fences[i], GL_SYNC_FLUSH_COMMANDS_BIT,
+                                1000000000) == GL_TIMEOUT_EXPIRED) {
+        }
+        glDeleteSync(fences[i]);
+        fences[i] = NULL;
+    }
+
+    void grow(size_t _capacity)
+    {
+        for (int i = 0; i < STREAM_FRAMES; i++) wait(i);
+
+        if (present) {
+            if (persistent) {
+                glBindBuffer(GL_ARRAY_BUFFER, buffer);
+                glUnmapBuffer(GL_ARRAY_BUFFER);
+            }
+            glDeleteBuffers(1, &buffer);
+        }
+
+        capacity = _capacity;
+        GLsizeiptr size = STREAM_FRAMES * capacity * sizeof(T);
+        glGenBuffers(1, &buffer);
+        glBindBuffer(GL_ARRAY_BUFFER, buffer);
+        if (persistent) {
+            GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT |
+                               GL_MAP_COHERENT_BIT;
+            glBufferStorage(GL_ARRAY_BUFFER, size, NULL, flags);
+            mapped = (T *)glMapBufferRange(GL_ARRAY_BUFFER, 0, size, flags);
+        }
+        else {
+            glBufferData(GL_ARRAY_BUFFER, size, NULL, GL_STREAM_DRAW);
+        }
+        check_gl_error();
+        present = true;
+    }
+
+    bool persistent = false;
+    size_t capacity = 0;
+    int region = 0;
+    T *mapped = NULL;
+    GLsync fences[STREAM_FRAMES] = {};
 };
 
 struct VertexAttribArray {
     void init(GLuint program, const char *name, int size);
-    void point_to(const ArrayBufferBase& ab) const;
+    // A field of an interleaved buffer, stride bytes per element
+    void init(GLuint program, const char *name, int size, GLenum type,
+              bool normalized, size_t stride, size_t field_offset);
+    void point_to(const ArrayBufferBase& ab, size_t offset=0) const;
     void disable(const ArrayBufferBase& ab) const;
     GLuint location;
     int size;
+    GLenum type = GL_FLOAT;
+    bool normalized = false;
+    size_t stride = 0;
+    size_t field_offset = 0;
+    // Read as ints by the shader rather than converted to floats
+    bool integer = false;
     bool instanced = false;
 };
 
 struct VertexAttribArrayMat4 {
     void init(GLuint program, const char *name);
-    void point_to(const ArrayBuffer<glm::mat4>& ab) const;
-    void disable(const ArrayBuffer<glm::mat4>& ab) const;
+    void point_to(const ArrayBufferBase& ab, size_t offset=0) const;
+    void disable(const ArrayBufferBase& ab) const;
     GLuint location0;
     VertexAttribArray attrib_array;
     bool instanced = false;
@@ -90,6 +210,7 @@ struct gl3_group {
     GLuint index_buffer;
     size_t count;
     void init(const wf_group &wf);
+    void init(const unsigned *triangle_indices, size_t count);
     void draw() const;
     void draw_instanced(int quantity) const;
     void bind_elements() const;
@@ -111,10 +232,11 @@ struct VertexArrayObject {
     GLuint location;
 };
 
+// One vertex of a gl3_mesh, see wf_packed_vertex
+typedef wf_packed_vertex gl3_vertex;
+
 struct gl3_mesh {
-    ArrayBuffer<float> vertex_buffer;
-    ArrayBuffer<float> normal_buffer;
-    ArrayBuffer<float> uv_buffer;
+    ArrayBuffer<gl3_vertex> vertex_buffer;
 
     std::map<std::string, gl3_group> groups;
     void draw_group(const std::string &group) const;
@@ -124,6 +246,7 @@ struct gl3_mesh {
     void draw_all_instanced(int n) const;
 
     void init(const wf_mesh &wf);
+    void init(const wf_mesh_view &wf);
 };
 
 struct Light {
@@ -137,6 +260,10 @@ struct Lights {
         direction.push_back(glm::normalize(l.direction));
         color.push_back(l.color);
     }
+    void clear() {
+        direction.clear();
+        color.clear();
+    }
 };
 
 struct Lightmap {
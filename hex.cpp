@@ -1,6 +1,10 @@
 #include "hex.hpp"
 
 #include <cassert>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
 
 /* Hex neighbors are sorted by edge. On a clock face, heading index 0 is noon, 
  * 1 is 2 o'clock, 2 is 4 o'clock, etc
@@ -49,3 +53,148 @@ HexCoord<double> pixel_to_hex_double(double x, double y)
     ret.r = -x / 3.0 + y * SQRT_3 / 3.0;
     return ret;
 }
+
+// Outward normals of the edges of a hex, counterclockwise from the one shared
+// with hex (1, 0). The neighbor across edge i is SQRT_3 * normal away.
+static const Point<double> edge_normals[6] = {
+    { SQRT_3 / 2,  0.5 },
+    { 0,           1   },
+    { -SQRT_3 / 2, 0.5 },
+    { -SQRT_3 / 2, -0.5 },
+    { 0,           -1   },
+    { SQRT_3 / 2,  -0.5 },
+};
+#define HEX_APOTHEM (SQRT_3 / 2)
+
+void hex_ray_walk(
+    double ox, double oy, double dx, double dy,
+    const std::function<bool(const HexCoord<int> &, double, double)> &fn)
+{
+    HexCoord<int> hex = pixel_to_hex_int(ox, oy);
+    double t_enter = 0;
+    for (;;) {
+        // The ray leaves through the nearest edge it's heading towards
+        Point<double> center = hex_to_pixel(hex);
+        double px = ox - center.x, py = oy - center.y;
+        double t_exit = INFINITY;
+        int edge = -1;
+        for (int i = 0; i < 6; i++) {
+            const Point<double> &n = edge_normals[i];
+            double speed = n.x * dx + n.y * dy;
+            if (speed <= 0) continue;
+            double t = (HEX_APOTHEM - (n.x * px + n.y * py)) / speed;
+            if (t < t_exit) {
+                t_exit = t;
+                edge = i;
+            }
+        }
+        t_exit = std::max(t_exit, t_enter);
+
+        if (!fn(hex, t_enter, t_exit) || edge < 0) return;
+
+        // Round the neighbor's center rather than adding an axial offset,
+        // so the walk can't drift off the grid.
+        t_enter = t_exit;
+        const Point<double> &n = edge_normals[edge];
+        hex = pixel_to_hex_int(center.x + SQRT_3 * n.x,
+                               center.y + SQRT_3 * n.y);
+    }
+}
+
+// Hexes per block claimed by a thread. Big enough to amortize the atomic,
+// small enough that a slow block at the end doesn't leave the others idle.
+#define PARALLEL_BLOCK 64
+
+namespace {
+
+class HexPool {
+public:
+    HexPool()
+    {
+        unsigned n = std::thread::hardware_concurrency();
+        for (unsigned i = 1; i < n; i++) {
+            threads.push_back(std::thread(&HexPool::worker, this));
+        }
+    }
+
+    ~HexPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            quit = true;
+        }
+        wake.notify_all();
+        for (std::thread &t : threads) t.join();
+    }
+
+    void run(const std::vector<HexCoord<int>> &_range,
+             const std::function<void(size_t, const HexCoord<int> &)> &_fn)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        range = &_range;
+        fn = &_fn;
+        next = 0;
+        busy = threads.size();
+        generation++;
+        lock.unlock();
+        wake.notify_all();
+
+        work();
+
+        lock.lock();
+        done.wait(lock, [this] { return busy == 0; });
+        range = NULL;
+        fn = NULL;
+    }
+
+private:
+    void work()
+    {
+        const size_t count = range->size();
+        for (;;) {
+            size_t begin = next.fetch_add(PARALLEL_BLOCK);
+            if (begin >= count) break;
+            size_t end = std::min(count, begin + PARALLEL_BLOCK);
+            for (size_t i = begin; i < end; i++) {
+                (*fn)(i, (*range)[i]);
+            }
+        }
+    }
+
+    void worker()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        unsigned seen = 0;
+        for (;;) {
+            wake.wait(lock, [&] { return quit || generation != seen; });
+            if (quit) break;
+            seen = generation;
+
+            lock.unlock();
+            work();
+            lock.lock();
+
+            if (--busy == 0) done.notify_one();
+        }
+    }
+
+    std::vector<std::thread> threads;
+    std::mutex mutex;
+    std::condition_variable wake, done;
+    const std::vector<HexCoord<int>> *range = NULL;
+    const std::function<void(size_t, const HexCoord<int> &)> *fn = NULL;
+    std::atomic<size_t> next;
+    size_t busy = 0;
+    unsigned generation = 0;
+    bool quit = false;
+};
+
+}
+
+void parallel_for_hexes(
+    const std::vector<HexCoord<int>> &range,
+    const std::function<void(size_t, const HexCoord<int> &)> &fn)
+{
+    static HexPool pool;
+    pool.run(range, fn);
+}
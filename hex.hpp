@@ -3,6 +3,8 @@
 #include <cassert>
 #include <cmath>
 #include <algorithm>
+#include <functional>
+#include <vector>
 
 #ifndef M_PI
 #define M_PI 3.1415926535897931159979634685441851615906
@@ -146,3 +148,17 @@ T hex_distance(const HexCoord<T>& a, const HexCoord<T>& b)
     return std::max(ret, dz);
 }
 
+// Visits the hexes under the ray (ox, oy) + t * (dx, dy), t >= 0, in the order
+// the ray crosses them. fn gets each hex with the t at which the ray enters and
+// leaves it, and returns false to stop the walk.
+void hex_ray_walk(
+    double ox, double oy, double dx, double dy,
+    const std::function<bool(const HexCoord<int> &, double, double)> &fn);
+
+// Calls fn(i, range[i]) for every hex in range using a pool of worker threads
+// and the calling thread, and returns once all calls are done. Blocks of
+// consecutive indices are handed out as threads become free, so fn should only
+// write to slot i of whatever it fills.
+void parallel_for_hexes(
+    const std::vector<HexCoord<int>> &range,
+    const std::function<void(size_t, const HexCoord<int> &)> &fn);
@@ -0,0 +1,131 @@
+#include "id_buffer.hpp"
+
+#define ID_ATTACHMENT GL_COLOR_ATTACHMENT1
+
+void IdBuffer::init()
+{
+    glGenFramebuffers(1, &framebuffer);
+    glGenRenderbuffers(1, &color);
+    glGenRenderbuffers(1, &ids);
+    glGenRenderbuffers(1, &depth);
+
+    for (Readback &readback : readbacks) {
+        glGenBuffers(1, &readback.pixel_buffer);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, readback.pixel_buffer);
+        glBufferData(GL_PIXEL_PACK_BUFFER, sizeof(uint32_t), NULL,
+                     GL_STREAM_READ);
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    check_gl_error();
+}
+
+void IdBuffer::bind(int w, int h)
+{
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    if (w == width && h == height) return;
+
+    width = w;
+    height = h;
+    glBindRenderbuffer(GL_RENDERBUFFER, color);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, w, h);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                              GL_RENDERBUFFER, color);
+    glBindRenderbuffer(GL_RENDERBUFFER, ids);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_R32UI, w, h);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, ID_ATTACHMENT,
+                              GL_RENDERBUFFER, ids);
+    glBindRenderbuffer(GL_RENDERBUFFER, depth);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, w, h);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT,
+                              GL_RENDERBUFFER, depth);
+
+    GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+    if (status != GL_FRAMEBUFFER_COMPLETE) {
+        fprintf(stderr, "Incomplete id framebuffer: 0x%x\n", status);
+        abort();
+    }
+    check_gl_error();
+}
+
+void IdBuffer::clear()
+{
+    // glClear is undefined on integer attachments, so the ids get their own
+    static const GLenum color_only[] = { GL_COLOR_ATTACHMENT0 };
+    static const GLenum both[] = { GL_COLOR_ATTACHMENT0, ID_ATTACHMENT };
+    static const GLuint no_id[4] = {};
+
+    glDrawBuffers(1, color_only);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    glDrawBuffers(2, both);
+    // Write masks apply to clears too, and the last draw may have left the
+    // ids masked off
+    glColorMaski(1, GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+    glClearBufferuiv(GL_COLOR, 1, no_id);
+    check_gl_error();
+}
+
+void IdBuffer::blit_to_default() const
+{
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, framebuffer);
+    glReadBuffer(GL_COLOR_ATTACHMENT0);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+    glDrawBuffer(GL_BACK);
+    glBlitFramebuffer(0, 0, width, height, 0, 0, width, height,
+                      GL_COLOR_BUFFER_BIT, GL_NEAREST);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    check_gl_error();
+}
+
+int IdBuffer::read(int x, int y)
+{
+    int slot = next;
+    next = (next + 1) % ID_BUFFER_READBACKS;
+
+    // A read still in flight here is older than one the caller will collect
+    // first anyway, so it's dropped rather than waited for.
+    Readback &readback = readbacks[slot];
+    if (readback.fence) glDeleteSync(readback.fence);
+    readback.fence = NULL;
+    if (x < 0 || y < 0 || x >= width || y >= height) return slot;
+
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, framebuffer);
+    glReadBuffer(ID_ATTACHMENT);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, readback.pixel_buffer);
+    glReadPixels(x, y, 1, 1, GL_RED_INTEGER, GL_UNSIGNED_INT, 0);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    readback.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    check_gl_error();
+    return slot;
+}
+
+bool IdBuffer::collect(int *slot, uint32_t *id)
+{
+    bool ret = false;
+    // Oldest first, so the newest finished read is the one returned
+    for (int i = 0; i < ID_BUFFER_READBACKS; i++) {
+        int s = (next + i) % ID_BUFFER_READBACKS;
+        Readback &readback = readbacks[s];
+        if (!readback.fence) continue;
+
+        GLenum status = glClientWaitSync(readback.fence,
+                                         GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+        if (status != GL_ALREADY_SIGNALED &&
+            status != GL_CONDITION_SATISFIED) {
+            // Later reads can't have finished before this one
+            break;
+        }
+        glDeleteSync(readback.fence);
+        readback.fence = NULL;
+
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, readback.pixel_buffer);
+        void *p = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, sizeof(uint32_t),
+                                   GL_MAP_READ_BIT);
+        *id = *(uint32_t *)p;
+        glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        *slot = s;
+        ret = true;
+    }
+    check_gl_error();
+    return ret;
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <cstdint>
+
+#include "gl3.hpp"
+
+// The streaming buffers let the CPU get STREAM_FRAMES frames ahead of the GPU,
+// so one more slot than that means a slot only comes round again once its
+// read has had time to finish, rather than being dropped every time.
+#define ID_BUFFER_READBACKS (STREAM_FRAMES + 1)
+
+/* Offscreen target for the scene with an integer attachment, which pickable
+ * draws fill with their instance id + 1, leaving 0 where nothing pickable is.
+ * Ids are read back one texel at a time through a pixel buffer and collected
+ * on a later frame once their fence has passed, so picking never waits for
+ * the GPU. Only needs GL 3.0 framebuffers, which llvmpipe has.
+ */
+struct IdBuffer {
+    void init();
+    // Matches the attachments to the framebuffer size and draws into them
+    void bind(int w, int h);
+    // Clears color and depth as glClear would, and the ids to 0
+    void clear();
+    // Copies the color attachment to the window's back buffer
+    void blit_to_default() const;
+
+    // Starts reading the id under framebuffer pixel (x, y) and returns the
+    // slot the result will be collected from
+    int read(int x, int y);
+    // The newest read that has finished since the last call, if any
+    bool collect(int *slot, uint32_t *id);
+
+private:
+    struct Readback {
+        GLuint pixel_buffer;
+        GLsync fence = NULL;
+    };
+
+    GLuint framebuffer;
+    GLuint color, ids, depth;
+    int width = 0, height = 0;
+    Readback readbacks[ID_BUFFER_READBACKS];
+    int next = 0;
+};
@@ -33,3 +33,317 @@ float ray_intersects_triangle(const Ray &ray, Triangle triangle)
     float t = f * glm::dot(edge2, q);
     return std::abs(t) > EPSILON ? t : INFINITY;
 }
+
+static triangles_soa_fn pick_triangles_soa();
+
+TrianglesSoA::TrianglesSoA() : kernel(pick_triangles_soa())
+{
+}
+
+TrianglesSoA::TrianglesSoA(const std::vector<Triangle> &triangles)
+    : kernel(pick_triangles_soa())
+{
+    count = triangles.size();
+    size_t padded = (count + TRIANGLES_SOA_WIDTH - 1)
+                  / TRIANGLES_SOA_WIDTH * TRIANGLES_SOA_WIDTH;
+    for (auto *v : {&v0x, &v0y, &v0z, &e1x, &e1y, &e1z, &e2x, &e2y, &e2z}) {
+        v->assign(padded, 0);
+    }
+    for (size_t i = 0; i < count; i++) {
+        const glm::vec3 *v = triangles[i].vertices;
+        glm::vec3 edge1 = v[1] - v[0];
+        glm::vec3 edge2 = v[2] - v[0];
+        v0x[i] = v[0].x; v0y[i] = v[0].y; v0z[i] = v[0].z;
+        e1x[i] = edge1.x; e1y[i] = edge1.y; e1z[i] = edge1.z;
+        e2x[i] = edge2.x; e2y[i] = edge2.y; e2z[i] = edge2.z;
+    }
+}
+
+// The kernels follow ray_intersects_triangle() operation for operation, so
+// they all give the same distances.
+static float triangles_soa_scalar(const Ray &ray, const TrianglesSoA &tris)
+{
+    const glm::vec3 &o = ray.origin, &d = ray.direction;
+    float ret = INFINITY;
+    for (size_t i = 0; i < tris.padded_size(); i++) {
+        float hx = d.y * tris.e2z[i] - tris.e2y[i] * d.z;
+        float hy = d.z * tris.e2x[i] - tris.e2z[i] * d.x;
+        float hz = d.x * tris.e2y[i] - tris.e2x[i] * d.y;
+        float a = tris.e1x[i] * hx + tris.e1y[i] * hy + tris.e1z[i] * hz;
+        if (std::abs(a) < EPSILON) continue;
+
+        float f = 1.0 / a;
+        float sx = o.x - tris.v0x[i];
+        float sy = o.y - tris.v0y[i];
+        float sz = o.z - tris.v0z[i];
+        float u = f * (sx * hx + sy * hy + sz * hz);
+        if (u < 0.0 || u > 1.0) continue;
+
+        float qx = sy * tris.e1z[i] - tris.e1y[i] * sz;
+        float qy = sz * tris.e1x[i] - tris.e1z[i] * sx;
+        float qz = sx * tris.e1y[i] - tris.e1x[i] * sy;
+        float v = f * (d.x * qx + d.y * qy + d.z * qz);
+        if (v < 0.0 || u + v > 1.0) continue;
+
+        float t = f * (tris.e2x[i] * qx + tris.e2y[i] * qy + tris.e2z[i] * qz);
+        if (std::abs(t) > EPSILON) ret = std::min(ret, t);
+    }
+    return ret;
+}
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define INTERSECT_HAVE_SIMD
+#include <immintrin.h>
+
+#define INTERSECT_SSE41 __attribute__((target("sse4.1")))
+#define INTERSECT_AVX2 __attribute__((target("avx2")))
+
+static INTERSECT_SSE41 float triangles_soa_sse41(
+    const Ray &ray, const TrianglesSoA &tris)
+{
+    const __m128 ox = _mm_set1_ps(ray.origin.x);
+    const __m128 oy = _mm_set1_ps(ray.origin.y);
+    const __m128 oz = _mm_set1_ps(ray.origin.z);
+    const __m128 dx = _mm_set1_ps(ray.direction.x);
+    const __m128 dy = _mm_set1_ps(ray.direction.y);
+    const __m128 dz = _mm_set1_ps(ray.direction.z);
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 one = _mm_set1_ps(1);
+    const __m128 epsilon = _mm_set1_ps(EPSILON);
+    const __m128 sign = _mm_set1_ps(-0.0f);
+    const __m128 miss = _mm_set1_ps(INFINITY);
+    __m128 best = miss;
+
+    for (size_t i = 0; i < tris.padded_size(); i += 4) {
+        __m128 e1x = _mm_loadu_ps(&tris.e1x[i]);
+        __m128 e1y = _mm_loadu_ps(&tris.e1y[i]);
+        __m128 e1z = _mm_loadu_ps(&tris.e1z[i]);
+        __m128 e2x = _mm_loadu_ps(&tris.e2x[i]);
+        __m128 e2y = _mm_loadu_ps(&tris.e2y[i]);
+        __m128 e2z = _mm_loadu_ps(&tris.e2z[i]);
+
+        __m128 hx = _mm_sub_ps(_mm_mul_ps(dy, e2z), _mm_mul_ps(e2y, dz));
+        __m128 hy = _mm_sub_ps(_mm_mul_ps(dz, e2x), _mm_mul_ps(e2z, dx));
+        __m128 hz = _mm_sub_ps(_mm_mul_ps(dx, e2y), _mm_mul_ps(e2x, dy));
+        __m128 a = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e1x, hx),
+                                         _mm_mul_ps(e1y, hy)),
+                              _mm_mul_ps(e1z, hz));
+        __m128 hit = _mm_cmpge_ps(_mm_andnot_ps(sign, a), epsilon);
+
+        __m128 f = _mm_div_ps(one, a);
+        __m128 sx = _mm_sub_ps(ox, _mm_loadu_ps(&tris.v0x[i]));
+        __m128 sy = _mm_sub_ps(oy, _mm_loadu_ps(&tris.v0y[i]));
+        __m128 sz = _mm_sub_ps(oz, _mm_loadu_ps(&tris.v0z[i]));
+        __m128 u = _mm_mul_ps(f, _mm_add_ps(_mm_add_ps(_mm_mul_ps(sx, hx),
+                                                       _mm_mul_ps(sy, hy)),
+                                            _mm_mul_ps(sz, hz)));
+        hit = _mm_and_ps(hit, _mm_cmpge_ps(u, zero));
+        hit = _mm_and_ps(hit, _mm_cmple_ps(u, one));
+
+        __m128 qx = _mm_sub_ps(_mm_mul_ps(sy, e1z), _mm_mul_ps(e1y, sz));
+        __m128 qy = _mm_sub_ps(_mm_mul_ps(sz, e1x), _mm_mul_ps(e1z, sx));
+        __m128 qz = _mm_sub_ps(_mm_mul_ps(sx, e1y), _mm_mul_ps(e1x, sy));
+        __m128 v = _mm_mul_ps(f, _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, qx),
+                                                       _mm_mul_ps(dy, qy)),
+                                            _mm_mul_ps(dz, qz)));
+        hit = _mm_and_ps(hit, _mm_cmpge_ps(v, zero));
+        hit = _mm_and_ps(hit, _mm_cmple_ps(_mm_add_ps(u, v), one));
+
+        __m128 t = _mm_mul_ps(f, _mm_add_ps(_mm_add_ps(_mm_mul_ps(e2x, qx),
+                                                       _mm_mul_ps(e2y, qy)),
+                                            _mm_mul_ps(e2z, qz)));
+        hit = _mm_and_ps(hit, _mm_cmpgt_ps(_mm_andnot_ps(sign, t), epsilon));
+        best = _mm_min_ps(best, _mm_blendv_ps(miss, t, hit));
+    }
+
+    best = _mm_min_ps(best, _mm_movehl_ps(best, best));
+    best = _mm_min_ss(best, _mm_shuffle_ps(best, best, 1));
+    return _mm_cvtss_f32(best);
+}
+
+static INTERSECT_AVX2 float triangles_soa_avx2(
+    const Ray &ray, const TrianglesSoA &tris)
+{
+    const __m256 ox = _mm256_set1_ps(ray.origin.x);
+    const __m256 oy = _mm256_set1_ps(ray.origin.y);
+    const __m256 oz = _mm256_set1_ps(ray.origin.z);
+    const __m256 dx = _mm256_set1_ps(ray.direction.x);
+    const __m256 dy = _mm256_set1_ps(ray.direction.y);
+    const __m256 dz = _mm256_set1_ps(ray.direction.z);
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 one = _mm256_set1_ps(1);
+    const __m256 epsilon = _mm256_set1_ps(EPSILON);
+    const __m256 sign = _mm256_set1_ps(-0.0f);
+    const __m256 miss = _mm256_set1_ps(INFINITY);
+    __m256 best = miss;
+
+    for (size_t i = 0; i < tris.padded_size(); i += 8) {
+        __m256 e1x = _mm256_loadu_ps(&tris.e1x[i]);
+        __m256 e1y = _mm256_loadu_ps(&tris.e1y[i]);
+        __m256 e1z = _mm256_loadu_ps(&tris.e1z[i]);
+        __m256 e2x = _mm256_loadu_ps(&tris.e2x[i]);
+        __m256 e2y = _mm256_loadu_ps(&tris.e2y[i]);
+        __m256 e2z = _mm256_loadu_ps(&tris.e2z[i]);
+
+        __m256 hx = _mm256_sub_ps(_mm256_mul_ps(dy, e2z), _mm256_mul_ps(e2y, dz));
+        __m256 hy = _mm256_sub_ps(_mm256_mul_ps(dz, e2x), _mm256_mul_ps(e2z, dx));
+        __m256 hz = _mm256_sub_ps(_mm256_mul_ps(dx, e2y), _mm256_mul_ps(e2x, dy));
+        __m256 a = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(e1x, hx),
+                                               _mm256_mul_ps(e1y, hy)),
+                                 _mm256_mul_ps(e1z, hz));
+        __m256 hit = _mm256_cmp_ps(_mm256_andnot_ps(sign, a), epsilon, _CMP_GE_OQ);
+
+        __m256 f = _mm256_div_ps(one, a);
+        __m256 sx = _mm256_sub_ps(ox, _mm256_loadu_ps(&tris.v0x[i]));
+        __m256 sy = _mm256_sub_ps(oy, _mm256_loadu_ps(&tris.v0y[i]));
+        __m256 sz = _mm256_sub_ps(oz, _mm256_loadu_ps(&tris.v0z[i]));
+        __m256 u = _mm256_mul_ps(f, _mm256_add_ps(
+            _mm256_add_ps(_mm256_mul_ps(sx, hx), _mm256_mul_ps(sy, hy)),
+            _mm256_mul_ps(sz, hz)));
+        hit = _mm256_and_ps(hit, _mm256_cmp_ps(u, zero, _CMP_GE_OQ));
+        hit = _mm256_and_ps(hit, _mm256_cmp_ps(u, one, _CMP_LE_OQ));
+
+        __m256 qx = _mm256_sub_ps(_mm256_mul_ps(sy, e1z), _mm256_mul_ps(e1y, sz));
+        __m256 qy = _mm256_sub_ps(_mm256_mul_ps(sz, e1x), _mm256_mul_ps(e1z, sx));
+        __m256 qz = _mm256_sub_ps(_mm256_mul_ps(sx, e1y), _mm256_mul_ps(e1x, sy));
+        __m256 v = _mm256_mul_ps(f, _mm256_add_ps(
+            _mm256_add_ps(_mm256_mul_ps(dx, qx), _mm256_mul_ps(dy, qy)),
+            _mm256_mul_ps(dz, qz)));
+        hit = _mm256_and_ps(hit, _mm256_cmp_ps(v, zero, _CMP_GE_OQ));
+        hit = _mm256_and_ps(hit, _mm256_cmp_ps(_mm256_add_ps(u, v), one, _CMP_LE_OQ));
+
+        __m256 t = _mm256_mul_ps(f, _mm256_add_ps(
+            _mm256_add_ps(_mm256_mul_ps(e2x, qx), _mm256_mul_ps(e2y, qy)),
+            _mm256_mul_ps(e2z, qz)));
+        hit = _mm256_and_ps(hit, _mm256_cmp_ps(_mm256_andnot_ps(sign, t), epsilon, _CMP_GT_OQ));
+        best = _mm256_min_ps(best, _mm256_blendv_ps(miss, t, hit));
+    }
+
+    __m128 half = _mm_min_ps(_mm256_castps256_ps128(best),
+                             _mm256_extractf128_ps(best, 1));
+    half = _mm_min_ps(half, _mm_movehl_ps(half, half));
+    half = _mm_min_ss(half, _mm_shuffle_ps(half, half, 1));
+    return _mm_cvtss_f32(half);
+}
+#endif /* INTERSECT_HAVE_SIMD */
+
+static triangles_soa_fn pick_triangles_soa()
+{
+#ifdef INTERSECT_HAVE_SIMD
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        return triangles_soa_avx2;
+    if (__builtin_cpu_supports("sse4.1"))
+        return triangles_soa_sse41;
+#endif
+    return triangles_soa_scalar;
+}
+
+float ray_intersects_triangles_soa(const Ray &ray, const TrianglesSoA &tris)
+{
+    return tris.kernel(ray, tris);
+}
+
+float ray_intersects_aabb(const Ray &ray, const AABB &box)
+{
+    // Slab test. Dividing by a zero direction component gives infinities
+    // which fall out of the min/max correctly.
+    glm::vec3 inv = 1.0f / ray.direction;
+    glm::vec3 t0 = (box.lo - ray.origin) * inv;
+    glm::vec3 t1 = (box.hi - ray.origin) * inv;
+    glm::vec3 near = glm::min(t0, t1);
+    glm::vec3 far = glm::max(t0, t1);
+    float enter = std::max(std::max(near.x, near.y), std::max(near.z, 0.0f));
+    float exit = std::min(std::min(far.x, far.y), far.z);
+    return enter <= exit ? enter : INFINITY;
+}
+
+AABB triangles_bounds(const std::vector<Triangle> &triangles)
+{
+    AABB ret = { glm::vec3(INFINITY), glm::vec3(-INFINITY) };
+    for (const Triangle &triangle : triangles) {
+        for (int i = 0; i < 3; i++) {
+            ret.lo = glm::min(ret.lo, triangle.vertices[i]);
+            ret.hi = glm::max(ret.hi, triangle.vertices[i]);
+        }
+    }
+    return ret;
+}
+
+PickMesh::PickMesh(const std::vector<Triangle> &triangles)
+    : bounds(triangles_bounds(triangles)), triangles(triangles)
+{
+}
+
+Ray transform_ray(const glm::mat4 &matrix, const Ray &ray)
+{
+    Ray ret = {
+        .origin = glm::vec3(matrix * glm::vec4(ray.origin, 1)),
+        .direction = glm::vec3(matrix * glm::vec4(ray.direction, 0))
+    };
+    return ret;
+}
+
+float ray_intersects_mesh(const Ray &ray, const PickMesh &mesh)
+{
+    if (ray_intersects_aabb(ray, mesh.bounds) == INFINITY) {
+        return INFINITY;
+    }
+    return ray_intersects_triangles_soa(ray, mesh.triangles);
+}
+
+#ifdef TEST
+#include <cstdio>
+#include <cstdlib>
+
+// Compares each kernel the CPU supports against ray_intersects_triangle
+#define TEST_TRIANGLES 61
+#define TEST_RAYS 10000
+
+static float random_float()
+{
+    return rand() / (float)RAND_MAX * 2 - 1;
+}
+
+static int check_kernel(const char *name, triangles_soa_fn fn,
+                        const std::vector<Triangle> &triangles,
+                        const std::vector<Ray> &rays)
+{
+    TrianglesSoA soa(triangles);
+    int bad = 0, hits = 0;
+    for (const Ray &ray : rays) {
+        float expected = INFINITY;
+        for (const Triangle &triangle : triangles) {
+            expected = std::min(expected, ray_intersects_triangle(ray, triangle));
+        }
+        bad += fn(ray, soa) != expected;
+        hits += expected != INFINITY;
+    }
+    printf("%s: %d/%d differ, %d hits\n", name, bad, TEST_RAYS, hits);
+    return bad;
+}
+
+int main()
+{
+    std::vector<Triangle> triangles(TEST_TRIANGLES);
+    for (Triangle &triangle : triangles) {
+        for (glm::vec3 &v : triangle.vertices) {
+            v = glm::vec3(random_float(), random_float(), random_float());
+        }
+    }
+    std::vector<Ray> rays(TEST_RAYS);
+    for (Ray &ray : rays) {
+        ray.origin = glm::vec3(random_float(), random_float(), 2);
+        ray.direction = glm::vec3(random_float(), random_float(), -1);
+    }
+
+    int bad = check_kernel("scalar", triangles_soa_scalar, triangles, rays);
+#ifdef INTERSECT_HAVE_SIMD
+    if (__builtin_cpu_supports("sse4.1"))
+        bad += check_kernel("sse4.1", triangles_soa_sse41, triangles, rays);
+    if (__builtin_cpu_supports("avx2"))
+        bad += check_kernel("avx2", triangles_soa_avx2, triangles, rays);
+#endif
+    return bad != 0;
+}
+#endif
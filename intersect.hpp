@@ -7,4 +7,52 @@ struct Ray {
     glm::vec3 origin, direction;
 };
 
+struct AABB {
+    glm::vec3 lo, hi;
+};
+
+// Triangles as structure of arrays with the edges precomputed, for testing
+// one ray against several at once. The arrays are padded with degenerate
+// triangles, which never hit, to a whole number of SIMD batches.
+#define TRIANGLES_SOA_WIDTH 8
+struct TrianglesSoA;
+typedef float (*triangles_soa_fn)(const Ray &, const TrianglesSoA &);
+
+struct TrianglesSoA {
+    size_t count = 0;
+    std::vector<float> v0x, v0y, v0z;
+    std::vector<float> e1x, e1y, e1z;
+    std::vector<float> e2x, e2y, e2z;
+    // The widest kernel the CPU supports, picked when the triangles are
+    // prepared so picking never has to
+    triangles_soa_fn kernel;
+
+    TrianglesSoA();
+    explicit TrianglesSoA(const std::vector<Triangle> &triangles);
+
+    size_t padded_size() const { return v0x.size(); }
+};
+
+// What picking needs to know about a mesh, computed once at load time in the
+// mesh's own space. Instances are tested by moving the ray into that space
+// with the inverse of their model matrix.
+struct PickMesh {
+    AABB bounds;
+    TrianglesSoA triangles;
+
+    PickMesh() {}
+    explicit PickMesh(const std::vector<Triangle> &triangles);
+};
+
 float ray_intersects_triangle(const Ray &, Triangle);
+// Same as the least ray_intersects_triangle() over all the triangles
+float ray_intersects_triangles_soa(const Ray &, const TrianglesSoA &);
+// Distance along the ray to where it enters the box, 0 if it starts inside
+float ray_intersects_aabb(const Ray &, const AABB &);
+AABB triangles_bounds(const std::vector<Triangle> &);
+
+// Distances along the ray are the same before and after an affine transform,
+// since the direction isn't renormalized.
+Ray transform_ray(const glm::mat4 &, const Ray &);
+// Closest hit on the mesh of a ray already in the mesh's space
+float ray_intersects_mesh(const Ray &, const PickMesh &);
@@ -34,11 +34,26 @@
 
 #define DEFAULT_SEED (0LL)
 
+struct osn_context;
+
+typedef void (*noise2_batch_fn)(struct osn_context *,
+    const double *, const double *, double *, int);
+typedef void (*noise2f_batch_fn)(struct osn_context *,
+    const float *, const float *, float *, int);
+
 struct osn_context {
 	int16_t *perm;
 	int16_t *permGradIndex3D;
+	int32_t perm32[256]; /* perm widened for SIMD gathers */
+	/* Batch kernels for this CPU, picked when the context is created so
+	 * threads sharing it never race to pick them */
+	noise2_batch_fn noise2_batch;
+	noise2f_batch_fn noise2f_batch;
 };
 
+static noise2_batch_fn pick_noise2_batch(void);
+static noise2f_batch_fn pick_noise2f_batch(void);
+
 #define ARRAYSIZE(x) (sizeof((x)) / sizeof((x)[0]))
 
 /*
@@ -156,6 +171,7 @@ int open_simplex_noise_init_perm(struct osn_context *ctx, int16_t p[], int nelem
 	for (i = 0; i < 256; i++) {
 		/* Since 3D has 24 gradients, simple bitmask won't work, so precompute modulo array. */
 		ctx->permGradIndex3D[i] = (int16_t)((ctx->perm[i] % (ARRAYSIZE(gradients3D) / 3)) * 3);
+		ctx->perm32[i] = ctx->perm[i];
 	}
 	return 0;
 }
@@ -179,6 +195,8 @@ int open_simplex_noise(int64_t seed, struct osn_context **ctx)
 		return -ENOMEM;
 	(*ctx)->perm = NULL;
 	(*ctx)->permGradIndex3D = NULL;
+	(*ctx)->noise2_batch = pick_noise2_batch();
+	(*ctx)->noise2f_batch = pick_noise2f_batch();
 
 	rc = allocate_perm(*ctx, 256, 256);
 	if (rc) {
@@ -201,6 +219,7 @@ int open_simplex_noise(int64_t seed, struct osn_context **ctx)
 			r += (i + 1);
 		perm[i] = source[r];
 		permGradIndex3D[i] = (short)((perm[i] % (ARRAYSIZE(gradients3D) / 3)) * 3);
+		(*ctx)->perm32[i] = perm[i];
 		source[r] = source[i];
 	}
 	return 0;
@@ -363,6 +382,426 @@ double open_simplex_noise2(struct osn_context *ctx, double x, double y)
 	return value / NORM_CONSTANT_2D;
 }
 
+/*
+ * Batched 2D noise. Every lane runs the same straight-line code: the region
+ * tests in open_simplex_noise2 become masks which select the extra vertex, and
+ * the attenuation tests zero out a contribution instead of skipping it. Terms
+ * are computed and summed in the same order as the scalar code, so the double
+ * precision kernels give bit-identical results.
+ */
+
+static const double gradients2D_x[] = { 5, 2, -5, -2, 5, 2, -5, -2 };
+static const double gradients2D_y[] = { 2, 5, 2, 5, -2, -5, -2, -5 };
+static const float gradients2D_xf[] = { 5, 2, -5, -2, 5, 2, -5, -2 };
+static const float gradients2D_yf[] = { 2, 5, 2, 5, -2, -5, -2, -5 };
+
+static void noise2_batch_scalar(struct osn_context *ctx,
+    const double *x, const double *y, double *out, int n)
+{
+	for (int i = 0; i < n; i++)
+		out[i] = open_simplex_noise2(ctx, x[i], y[i]);
+}
+
+static void noise2f_batch_scalar(struct osn_context *ctx,
+    const float *x, const float *y, float *out, int n)
+{
+	for (int i = 0; i < n; i++)
+		out[i] = open_simplex_noise2(ctx, x[i], y[i]);
+}
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define OSN_HAVE_SIMD
+#include <immintrin.h>
+
+#define OSN_SSE41 __attribute__((target("sse4.1")))
+#define OSN_AVX2 __attribute__((target("avx2")))
+
+/* attn^4 * gradient, or zero where attn <= 0 */
+static OSN_SSE41 __m128d contrib2_sse41(struct osn_context *ctx,
+    __m128d xsb, __m128d ysb, __m128d dx, __m128d dy)
+{
+	__m128d attn = _mm_sub_pd(_mm_sub_pd(_mm_set1_pd(2), _mm_mul_pd(dx, dx)),
+	                          _mm_mul_pd(dy, dy));
+	__m128d live = _mm_cmpgt_pd(attn, _mm_setzero_pd());
+	attn = _mm_mul_pd(attn, attn);
+	attn = _mm_mul_pd(attn, attn);
+
+	/* No gathers before AVX2, so look the gradients up one lane at a time */
+	int32_t xi[4], yi[4];
+	double dxs[2], dys[2], g[2];
+	_mm_storeu_si128((__m128i *)xi, _mm_cvtpd_epi32(xsb));
+	_mm_storeu_si128((__m128i *)yi, _mm_cvtpd_epi32(ysb));
+	_mm_storeu_pd(dxs, dx);
+	_mm_storeu_pd(dys, dy);
+	for (int k = 0; k < 2; k++)
+		g[k] = extrapolate2(ctx, xi[k], yi[k], dxs[k], dys[k]);
+
+	return _mm_and_pd(live, _mm_mul_pd(attn, _mm_loadu_pd(g)));
+}
+
+static OSN_SSE41 void noise2_batch_sse41(struct osn_context *ctx,
+    const double *x, const double *y, double *out, int n)
+{
+	const __m128d zero = _mm_setzero_pd();
+	const __m128d one = _mm_set1_pd(1);
+	const __m128d two = _mm_set1_pd(2);
+	const __m128d squish = _mm_set1_pd(SQUISH_CONSTANT_2D);
+	const __m128d squish2 = _mm_set1_pd(2 * SQUISH_CONSTANT_2D);
+	int i = 0;
+
+	for (; i + 2 <= n; i += 2) {
+		__m128d px = _mm_loadu_pd(x + i);
+		__m128d py = _mm_loadu_pd(y + i);
+
+		/* Place input coordinates onto grid. */
+		__m128d stretch = _mm_mul_pd(_mm_add_pd(px, py),
+		                             _mm_set1_pd(STRETCH_CONSTANT_2D));
+		__m128d xs = _mm_add_pd(px, stretch);
+		__m128d ys = _mm_add_pd(py, stretch);
+		__m128d xsb = _mm_floor_pd(xs);
+		__m128d ysb = _mm_floor_pd(ys);
+
+		__m128d squish_offset = _mm_mul_pd(_mm_add_pd(xsb, ysb), squish);
+		__m128d xins = _mm_sub_pd(xs, xsb);
+		__m128d yins = _mm_sub_pd(ys, ysb);
+		__m128d in_sum = _mm_add_pd(xins, yins);
+		__m128d dx0 = _mm_sub_pd(px, _mm_add_pd(xsb, squish_offset));
+		__m128d dy0 = _mm_sub_pd(py, _mm_add_pd(ysb, squish_offset));
+
+		__m128d value = zero;
+
+		/* Contribution (1,0) */
+		value = _mm_add_pd(value, contrib2_sse41(ctx,
+			_mm_add_pd(xsb, one), ysb,
+			_mm_sub_pd(_mm_sub_pd(dx0, one), squish),
+			_mm_sub_pd(dy0, squish)));
+
+		/* Contribution (0,1) */
+		value = _mm_add_pd(value, contrib2_sse41(ctx,
+			xsb, _mm_add_pd(ysb, one),
+			_mm_sub_pd(dx0, squish),
+			_mm_sub_pd(_mm_sub_pd(dy0, one), squish)));
+
+		/* Extra vertex offsets (ox, oy) and skew b, for each region */
+		__m128d lower = _mm_cmple_pd(in_sum, one);
+		__m128d x_gt_y = _mm_cmpgt_pd(xins, yins);
+
+		__m128d zins = _mm_sub_pd(one, in_sum);
+		__m128d near_a = _mm_or_pd(_mm_cmpgt_pd(zins, xins),
+		                           _mm_cmpgt_pd(zins, yins));
+		__m128d ox_a = _mm_blendv_pd(one,
+			_mm_blendv_pd(_mm_set1_pd(-1), one, x_gt_y), near_a);
+		__m128d oy_a = _mm_blendv_pd(one,
+			_mm_blendv_pd(one, _mm_set1_pd(-1), x_gt_y), near_a);
+		__m128d b_a = _mm_andnot_pd(near_a, squish2);
+
+		zins = _mm_sub_pd(two, in_sum);
+		__m128d near_b = _mm_or_pd(_mm_cmplt_pd(zins, xins),
+		                           _mm_cmplt_pd(zins, yins));
+		__m128d ox_b = _mm_and_pd(near_b, _mm_and_pd(x_gt_y, two));
+		__m128d oy_b = _mm_and_pd(near_b, _mm_andnot_pd(x_gt_y, two));
+		__m128d b_b = _mm_and_pd(near_b, squish2);
+
+		__m128d ox = _mm_blendv_pd(ox_b, ox_a, lower);
+		__m128d oy = _mm_blendv_pd(oy_b, oy_a, lower);
+		__m128d b = _mm_blendv_pd(b_b, b_a, lower);
+		__m128d dx_ext = _mm_sub_pd(_mm_sub_pd(dx0, ox), b);
+		__m128d dy_ext = _mm_sub_pd(_mm_sub_pd(dy0, oy), b);
+		__m128d xsv_ext = _mm_add_pd(xsb, ox);
+		__m128d ysv_ext = _mm_add_pd(ysb, oy);
+
+		/* In the (1,1) triangle the base vertex moves to (1,1) */
+		__m128d shift = _mm_andnot_pd(lower, one);
+		__m128d shift_squish = _mm_andnot_pd(lower, squish2);
+		xsb = _mm_add_pd(xsb, shift);
+		ysb = _mm_add_pd(ysb, shift);
+		dx0 = _mm_sub_pd(_mm_sub_pd(dx0, shift), shift_squish);
+		dy0 = _mm_sub_pd(_mm_sub_pd(dy0, shift), shift_squish);
+
+		/* Contribution (0,0) or (1,1) */
+		value = _mm_add_pd(value, contrib2_sse41(ctx, xsb, ysb, dx0, dy0));
+
+		/* Extra Vertex */
+		value = _mm_add_pd(value, contrib2_sse41(ctx,
+			xsv_ext, ysv_ext, dx_ext, dy_ext));
+
+		_mm_storeu_pd(out + i, _mm_div_pd(value, _mm_set1_pd(NORM_CONSTANT_2D)));
+	}
+
+	noise2_batch_scalar(ctx, x + i, y + i, out + i, n - i);
+}
+
+static OSN_AVX2 __m256d contrib2_avx2(struct osn_context *ctx,
+    __m256d xsb, __m256d ysb, __m256d dx, __m256d dy)
+{
+	__m256d attn = _mm256_sub_pd(
+		_mm256_sub_pd(_mm256_set1_pd(2), _mm256_mul_pd(dx, dx)),
+		_mm256_mul_pd(dy, dy));
+	__m256d live = _mm256_cmp_pd(attn, _mm256_setzero_pd(), _CMP_GT_OQ);
+	attn = _mm256_mul_pd(attn, attn);
+	attn = _mm256_mul_pd(attn, attn);
+
+	const __m128i byte = _mm_set1_epi32(0xFF);
+	__m128i index = _mm_i32gather_epi32(ctx->perm32,
+		_mm_and_si128(_mm256_cvtpd_epi32(xsb), byte), 4);
+	index = _mm_add_epi32(index, _mm256_cvtpd_epi32(ysb));
+	index = _mm_i32gather_epi32(ctx->perm32, _mm_and_si128(index, byte), 4);
+	index = _mm_srli_epi32(_mm_and_si128(index, _mm_set1_epi32(0x0E)), 1);
+
+	__m256d g = _mm256_add_pd(
+		_mm256_mul_pd(_mm256_i32gather_pd(gradients2D_x, index, 8), dx),
+		_mm256_mul_pd(_mm256_i32gather_pd(gradients2D_y, index, 8), dy));
+
+	return _mm256_and_pd(live, _mm256_mul_pd(attn, g));
+}
+
+static OSN_AVX2 void noise2_batch_avx2(struct osn_context *ctx,
+    const double *x, const double *y, double *out, int n)
+{
+	const __m256d zero = _mm256_setzero_pd();
+	const __m256d one = _mm256_set1_pd(1);
+	const __m256d two = _mm256_set1_pd(2);
+	const __m256d squish = _mm256_set1_pd(SQUISH_CONSTANT_2D);
+	const __m256d squish2 = _mm256_set1_pd(2 * SQUISH_CONSTANT_2D);
+	int i = 0;
+
+	for (; i + 4 <= n; i += 4) {
+		__m256d px = _mm256_loadu_pd(x + i);
+		__m256d py = _mm256_loadu_pd(y + i);
+
+		/* Place input coordinates onto grid. */
+		__m256d stretch = _mm256_mul_pd(_mm256_add_pd(px, py),
+		                                _mm256_set1_pd(STRETCH_CONSTANT_2D));
+		__m256d xs = _mm256_add_pd(px, stretch);
+		__m256d ys = _mm256_add_pd(py, stretch);
+		__m256d xsb = _mm256_floor_pd(xs);
+		__m256d ysb = _mm256_floor_pd(ys);
+
+		__m256d squish_offset = _mm256_mul_pd(_mm256_add_pd(xsb, ysb), squish);
+		__m256d xins = _mm256_sub_pd(xs, xsb);
+		__m256d yins = _mm256_sub_pd(ys, ysb);
+		__m256d in_sum = _mm256_add_pd(xins, yins);
+		__m256d dx0 = _mm256_sub_pd(px, _mm256_add_pd(xsb, squish_offset));
+		__m256d dy0 = _mm256_sub_pd(py, _mm256_add_pd(ysb, squish_offset));
+
+		__m256d value = zero;
+
+		/* Contribution (1,0) */
+		value = _mm256_add_pd(value, contrib2_avx2(ctx,
+			_mm256_add_pd(xsb, one), ysb,
+			_mm256_sub_pd(_mm256_sub_pd(dx0, one), squish),
+			_mm256_sub_pd(dy0, squish)));
+
+		/* Contribution (0,1) */
+		value = _mm256_add_pd(value, contrib2_avx2(ctx,
+			xsb, _mm256_add_pd(ysb, one),
+			_mm256_sub_pd(dx0, squish),
+			_mm256_sub_pd(_mm256_sub_pd(dy0, one), squish)));
+
+		/* Extra vertex offsets (ox, oy) and skew b, for each region */
+		__m256d lower = _mm256_cmp_pd(in_sum, one, _CMP_LE_OQ);
+		__m256d x_gt_y = _mm256_cmp_pd(xins, yins, _CMP_GT_OQ);
+
+		__m256d zins = _mm256_sub_pd(one, in_sum);
+		__m256d near_a = _mm256_or_pd(_mm256_cmp_pd(zins, xins, _CMP_GT_OQ),
+		                              _mm256_cmp_pd(zins, yins, _CMP_GT_OQ));
+		__m256d ox_a = _mm256_blendv_pd(one,
+			_mm256_blendv_pd(_mm256_set1_pd(-1), one, x_gt_y), near_a);
+		__m256d oy_a = _mm256_blendv_pd(one,
+			_mm256_blendv_pd(one, _mm256_set1_pd(-1), x_gt_y), near_a);
+		__m256d b_a = _mm256_andnot_pd(near_a, squish2);
+
+		zins = _mm256_sub_pd(two, in_sum);
+		__m256d near_b = _mm256_or_pd(_mm256_cmp_pd(zins, xins, _CMP_LT_OQ),
+		                              _mm256_cmp_pd(zins, yins, _CMP_LT_OQ));
+		__m256d ox_b = _mm256_and_pd(near_b, _mm256_and_pd(x_gt_y, two));
+		__m256d oy_b = _mm256_and_pd(near_b, _mm256_andnot_pd(x_gt_y, two));
+		__m256d b_b = _mm256_and_pd(near_b, squish2);
+
+		__m256d ox = _mm256_blendv_pd(ox_b, ox_a, lower);
+		__m256d oy = _mm256_blendv_pd(oy_b, oy_a, lower);
+		__m256d b = _mm256_blendv_pd(b_b, b_a, lower);
+		__m256d dx_ext = _mm256_sub_pd(_mm256_sub_pd(dx0, ox), b);
+		__m256d dy_ext = _mm256_sub_pd(_mm256_sub_pd(dy0, oy), b);
+		__m256d xsv_ext = _mm256_add_pd(xsb, ox);
+		__m256d ysv_ext = _mm256_add_pd(ysb, oy);
+
+		/* In the (1,1) triangle the base vertex moves to (1,1) */
+		__m256d shift = _mm256_andnot_pd(lower, one);
+		__m256d shift_squish = _mm256_andnot_pd(lower, squish2);
+		xsb = _mm256_add_pd(xsb, shift);
+		ysb = _mm256_add_pd(ysb, shift);
+		dx0 = _mm256_sub_pd(_mm256_sub_pd(dx0, shift), shift_squish);
+		dy0 = _mm256_sub_pd(_mm256_sub_pd(dy0, shift), shift_squish);
+
+		/* Contribution (0,0) or (1,1) */
+		value = _mm256_add_pd(value, contrib2_avx2(ctx, xsb, ysb, dx0, dy0));
+
+		/* Extra Vertex */
+		value = _mm256_add_pd(value, contrib2_avx2(ctx,
+			xsv_ext, ysv_ext, dx_ext, dy_ext));
+
+		_mm256_storeu_pd(out + i,
+			_mm256_div_pd(value, _mm256_set1_pd(NORM_CONSTANT_2D)));
+	}
+
+	noise2_batch_scalar(ctx, x + i, y + i, out + i, n - i);
+}
+
+static OSN_AVX2 __m256 contrib2f_avx2(struct osn_context *ctx,
+    __m256 xsb, __m256 ysb, __m256 dx, __m256 dy)
+{
+	__m256 attn = _mm256_sub_ps(
+		_mm256_sub_ps(_mm256_set1_ps(2), _mm256_mul_ps(dx, dx)),
+		_mm256_mul_ps(dy, dy));
+	__m256 live = _mm256_cmp_ps(attn, _mm256_setzero_ps(), _CMP_GT_OQ);
+	attn = _mm256_mul_ps(attn, attn);
+	attn = _mm256_mul_ps(attn, attn);
+
+	const __m256i byte = _mm256_set1_epi32(0xFF);
+	__m256i index = _mm256_i32gather_epi32(ctx->perm32,
+		_mm256_and_si256(_mm256_cvtps_epi32(xsb), byte), 4);
+	index = _mm256_add_epi32(index, _mm256_cvtps_epi32(ysb));
+	index = _mm256_i32gather_epi32(ctx->perm32,
+		_mm256_and_si256(index, byte), 4);
+	index = _mm256_srli_epi32(
+		_mm256_and_si256(index, _mm256_set1_epi32(0x0E)), 1);
+
+	__m256 g = _mm256_add_ps(
+		_mm256_mul_ps(_mm256_i32gather_ps(gradients2D_xf, index, 4), dx),
+		_mm256_mul_ps(_mm256_i32gather_ps(gradients2D_yf, index, 4), dy));
+
+	return _mm256_and_ps(live, _mm256_mul_ps(attn, g));
+}
+
+static OSN_AVX2 void noise2f_batch_avx2(struct osn_context *ctx,
+    const float *x, const float *y, float *out, int n)
+{
+	const __m256 zero = _mm256_setzero_ps();
+	const __m256 one = _mm256_set1_ps(1);
+	const __m256 two = _mm256_set1_ps(2);
+	const __m256 squish = _mm256_set1_ps(SQUISH_CONSTANT_2D);
+	const __m256 squish2 = _mm256_set1_ps(2 * SQUISH_CONSTANT_2D);
+	int i = 0;
+
+	for (; i + 8 <= n; i += 8) {
+		__m256 px = _mm256_loadu_ps(x + i);
+		__m256 py = _mm256_loadu_ps(y + i);
+
+		/* Place input coordinates onto grid. */
+		__m256 stretch = _mm256_mul_ps(_mm256_add_ps(px, py),
+		                               _mm256_set1_ps(STRETCH_CONSTANT_2D));
+		__m256 xs = _mm256_add_ps(px, stretch);
+		__m256 ys = _mm256_add_ps(py, stretch);
+		__m256 xsb = _mm256_floor_ps(xs);
+		__m256 ysb = _mm256_floor_ps(ys);
+
+		__m256 squish_offset = _mm256_mul_ps(_mm256_add_ps(xsb, ysb), squish);
+		__m256 xins = _mm256_sub_ps(xs, xsb);
+		__m256 yins = _mm256_sub_ps(ys, ysb);
+		__m256 in_sum = _mm256_add_ps(xins, yins);
+		__m256 dx0 = _mm256_sub_ps(px, _mm256_add_ps(xsb, squish_offset));
+		__m256 dy0 = _mm256_sub_ps(py, _mm256_add_ps(ysb, squish_offset));
+
+		__m256 value = zero;
+
+		/* Contribution (1,0) */
+		value = _mm256_add_ps(value, contrib2f_avx2(ctx,
+			_mm256_add_ps(xsb, one), ysb,
+			_mm256_sub_ps(_mm256_sub_ps(dx0, one), squish),
+			_mm256_sub_ps(dy0, squish)));
+
+		/* Contribution (0,1) */
+		value = _mm256_add_ps(value, contrib2f_avx2(ctx,
+			xsb, _mm256_add_ps(ysb, one),
+			_mm256_sub_ps(dx0, squish),
+			_mm256_sub_ps(_mm256_sub_ps(dy0, one), squish)));
+
+		/* Extra vertex offsets (ox, oy) and skew b, for each region */
+		__m256 lower = _mm256_cmp_ps(in_sum, one, _CMP_LE_OQ);
+		__m256 x_gt_y = _mm256_cmp_ps(xins, yins, _CMP_GT_OQ);
+
+		__m256 zins = _mm256_sub_ps(one, in_sum);
+		__m256 near_a = _mm256_or_ps(_mm256_cmp_ps(zins, xins, _CMP_GT_OQ),
+		                             _mm256_cmp_ps(zins, yins, _CMP_GT_OQ));
+		__m256 ox_a = _mm256_blendv_ps(one,
+			_mm256_blendv_ps(_mm256_set1_ps(-1), one, x_gt_y), near_a);
+		__m256 oy_a = _mm256_blendv_ps(one,
+			_mm256_blendv_ps(one, _mm256_set1_ps(-1), x_gt_y), near_a);
+		__m256 b_a = _mm256_andnot_ps(near_a, squish2);
+
+		zins = _mm256_sub_ps(two, in_sum);
+		__m256 near_b = _mm256_or_ps(_mm256_cmp_ps(zins, xins, _CMP_LT_OQ),
+		                             _mm256_cmp_ps(zins, yins, _CMP_LT_OQ));
+		__m256 ox_b = _mm256_and_ps(near_b, _mm256_and_ps(x_gt_y, two));
+		__m256 oy_b = _mm256_and_ps(near_b, _mm256_andnot_ps(x_gt_y, two));
+		__m256 b_b = _mm256_and_ps(near_b, squish2);
+
+		__m256 ox = _mm256_blendv_ps(ox_b, ox_a, lower);
+		__m256 oy = _mm256_blendv_ps(oy_b, oy_a, lower);
+		__m256 b = _mm256_blendv_ps(b_b, b_a, lower);
+		__m256 dx_ext = _mm256_sub_ps(_mm256_sub_ps(dx0, ox), b);
+		__m256 dy_ext = _mm256_sub_ps(_mm256_sub_ps(dy0, oy), b);
+		__m256 xsv_ext = _mm256_add_ps(xsb, ox);
+		__m256 ysv_ext = _mm256_add_ps(ysb, oy);
+
+		/* In the (1,1) triangle the base vertex moves to (1,1) */
+		__m256 shift = _mm256_andnot_ps(lower, one);
+		__m256 shift_squish = _mm256_andnot_ps(lower, squish2);
+		xsb = _mm256_add_ps(xsb, shift);
+		ysb = _mm256_add_ps(ysb, shift);
+		dx0 = _mm256_sub_ps(_mm256_sub_ps(dx0, shift), shift_squish);
+		dy0 = _mm256_sub_ps(_mm256_sub_ps(dy0, shift), shift_squish);
+
+		/* Contribution (0,0) or (1,1) */
+		value = _mm256_add_ps(value, contrib2f_avx2(ctx, xsb, ysb, dx0, dy0));
+
+		/* Extra Vertex */
+		value = _mm256_add_ps(value, contrib2f_avx2(ctx,
+			xsv_ext, ysv_ext, dx_ext, dy_ext));
+
+		_mm256_storeu_ps(out + i,
+			_mm256_div_ps(value, _mm256_set1_ps(NORM_CONSTANT_2D)));
+	}
+
+	noise2f_batch_scalar(ctx, x + i, y + i, out + i, n - i);
+}
+#endif /* OSN_HAVE_SIMD */
+
+static noise2_batch_fn pick_noise2_batch(void)
+{
+#ifdef OSN_HAVE_SIMD
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		return noise2_batch_avx2;
+	if (__builtin_cpu_supports("sse4.1"))
+		return noise2_batch_sse41;
+#endif
+	return noise2_batch_scalar;
+}
+
+static noise2f_batch_fn pick_noise2f_batch(void)
+{
+#ifdef OSN_HAVE_SIMD
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		return noise2f_batch_avx2;
+#endif
+	return noise2f_batch_scalar;
+}
+
+void open_simplex_noise2_batch(struct osn_context *ctx,
+    const double *x, const double *y, double *out, int n)
+{
+	ctx->noise2_batch(ctx, x, y, out, n);
+}
+
+void open_simplex_noise2f_batch(struct osn_context *ctx,
+    const float *x, const float *y, float *out, int n)
+{
+	ctx->noise2f_batch(ctx, x, y, out, n);
+}
+
 /*
  * 3D OpenSimplex (Simplectic) Noise
  */
@@ -2264,3 +2703,63 @@ double open_simplex_noise4(struct osn_context *ctx, double x, double y, double z
 	return value / NORM_CONSTANT_4D;
 }
 
+
+#ifdef TEST
+#include <stdio.h>
+
+/* Compares each batch kernel the CPU supports against open_simplex_noise2 */
+#define TEST_POINTS 4099
+
+static int check_batch(const char *name, struct osn_context *ctx,
+    noise2_batch_fn fn, const double *x, const double *y)
+{
+	static double out[TEST_POINTS];
+	int bad = 0;
+	fn(ctx, x, y, out, TEST_POINTS);
+	for (int i = 0; i < TEST_POINTS; i++)
+		bad += out[i] != open_simplex_noise2(ctx, x[i], y[i]);
+	printf("%s: %d/%d differ\n", name, bad, TEST_POINTS);
+	return bad;
+}
+
+static int check_batchf(const char *name, struct osn_context *ctx,
+    noise2f_batch_fn fn, const float *x, const float *y)
+{
+	static float out[TEST_POINTS];
+	double worst = 0;
+	fn(ctx, x, y, out, TEST_POINTS);
+	for (int i = 0; i < TEST_POINTS; i++)
+		worst = fmax(worst, fabs(out[i] - open_simplex_noise2(ctx, x[i], y[i])));
+	printf("%s: max error %g\n", name, worst);
+	return worst > 1e-4;
+}
+
+int main(void)
+{
+	static double x[TEST_POINTS], y[TEST_POINTS];
+	static float xf[TEST_POINTS], yf[TEST_POINTS];
+	struct osn_context *ctx;
+	int failures = 0;
+
+	open_simplex_noise(123, &ctx);
+	srand(1);
+	for (int i = 0; i < TEST_POINTS; i++) {
+		xf[i] = x[i] = 200.0 * rand() / RAND_MAX - 100;
+		yf[i] = y[i] = 200.0 * rand() / RAND_MAX - 100;
+	}
+
+	failures += check_batch("scalar", ctx, noise2_batch_scalar, x, y);
+	failures += check_batchf("scalar float", ctx, noise2f_batch_scalar, xf, yf);
+#ifdef OSN_HAVE_SIMD
+	if (__builtin_cpu_supports("sse4.1"))
+		failures += check_batch("sse4.1", ctx, noise2_batch_sse41, x, y);
+	if (__builtin_cpu_supports("avx2")) {
+		failures += check_batch("avx2", ctx, noise2_batch_avx2, x, y);
+		failures += check_batchf("avx2 float", ctx, noise2f_batch_avx2, xf, yf);
+	}
+#endif
+
+	open_simplex_noise_free(ctx);
+	return failures != 0;
+}
+#endif
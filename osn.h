@@ -44,6 +44,14 @@ double open_simplex_noise2(struct osn_context *ctx, double x, double y);
 double open_simplex_noise3(struct osn_context *ctx, double x, double y, double z);
 double open_simplex_noise4(struct osn_context *ctx, double x, double y, double z, double w);
 
+/* Evaluates open_simplex_noise2 at n points using the widest SIMD kernel the
+ * CPU supports. The double version matches the scalar function exactly; the
+ * float version is faster but only accurate to float precision. */
+void open_simplex_noise2_batch(struct osn_context *ctx,
+    const double *x, const double *y, double *out, int n);
+void open_simplex_noise2f_batch(struct osn_context *ctx,
+    const float *x, const float *y, float *out, int n);
+
 double open_simplex_noise2_harmonic(
     struct osn_context *ctx, double x, double y,
     double *harmonics, int num_harmonics);
@@ -3,6 +3,9 @@
 #include <set>
 #include <algorithm>
 #include <array>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
 
 #include <GL/glew.h>
 #include <GLFW/glfw3.h>
@@ -24,14 +27,17 @@ extern "C" {
 }
 
 #include "wavefront.hpp"
+#include "wavefront_cache.hpp"
 #include "gl3.hpp"
-#include "fir_filter.hpp"
+#include "smoothing.hpp"
 #include "hex.hpp"
 #include "time.hpp"
 #include "render_post.hpp"
 //#include "lmdebug.hpp"
 //#include "depthmap.hpp"
 #include "intersect.hpp"
+#include "chunk_cache.hpp"
+#include "id_buffer.hpp"
 
 #define MIN(x, y) ((x) < (y) ? (x) : (y))
 #define MAX(x, y) ((x) >= (y) ? (x) : (y))
@@ -57,6 +63,8 @@ gl3_material cursor_mtl, pine_material;
 //LmDebug lmdebug;
 int debug_show_lightmap = 0;
 int enable_shadows = 1;
+int gpu_picking = 0;
+IdBuffer id_buffer;
 Framebuffer depth_fb;
 Depthmap depthmap;
 
@@ -66,38 +74,40 @@ struct Meshes {
     gl3_mesh cursor_mesh;
     //gl3_mesh lmdebug_mesh;
 };
-std::vector<Triangle> post_triangles;
+PickMesh post_pick;
 RenderPost render_post;
 RenderPost render_pine;
-
-// scipy.signal.firwin(20, 0.01)
-const vector<float> view_filter_coeffs {
-    0.00764156,  0.01005217,  0.01700178,  0.02776751,  0.04120037,
-    0.05585069,  0.07012762,  0.0824749 ,  0.09154324,  0.09634015,
-    0.09634015,  0.09154324,  0.0824749 ,  0.07012762,  0.05585069,
-    0.04120037,  0.02776751,  0.01700178,  0.01005217,  0.00764156
-};
-
-// scipy.signal.firwin(10, 0.01)
-const vector<float> fast_filter_coeffs {
-    0.01614987,  0.03792532,  0.09310069,  0.15590377,  0.19692034,
-    0.19692034,  0.15590377,  0.09310069,  0.03792532,  0.01614987
-};
+RenderPost render_cursor;
+int top_group, side_group;
 
 #define HEX_EXTENT 50
 #define CLIFF_HEIGHT 2
+#define MAX_PINES_PER_TILE 3
+#define CHUNK_CACHE_BUDGET (16 << 20)
+#define CHUNK_STORE_DIR "terrain_cache"
+
+// Kept between frames so building a frame reuses last frame's allocations
+RenderPost::Drawlist hex_drawlist, pine_drawlist, cursor_drawlist;
+static struct {
+    vector<HexCoord<int>> hexes;
+    vector<vec3> positions;
+    vector<float> visibilities;
+    // Relative to the hex they're on
+    vector<std::array<RenderPost::Instance, MAX_PINES_PER_TILE>> pines;
+    vector<int> pine_counts;
+} frame;
 
 GLFWwindow *window;
 struct {
     int yaw; // clock: 0->noon, 1->2o'clock, 2->4o'clock...
-    filtered_value<float> pitch, distance;
+    filtered_value<float, fast_filter<float>> pitch, distance;
     HexCoord<int> center;
     HexCoord<double> filtered_center;
 } view = {
     .yaw = 0,
-    .pitch = filtered_value<float>(fast_filter_coeffs,
+    .pitch = filtered_value<float, fast_filter<float>>(fast_filter_params,
         VIEW_MAX_PITCH, VIEW_MIN_PITCH),
-    .distance = filtered_value<float>(fast_filter_coeffs,
+    .distance = filtered_value<float, fast_filter<float>>(fast_filter_params,
         VIEW_MAX_DISTANCE, VIEW_MIN_DISTANCE),
     .center = {0, 0},
     .filtered_center = {0, 0},
@@ -109,13 +119,13 @@ const glm::vec3 moon_color(0.3, 0.4, 0.5);
 
 #define LATITUDE 0.4
 
-fir_filter<vec3> center_filter(view_filter_coeffs, vec3(0, 0, 0));
-fir_filter<float> eye_angle_filter(view_filter_coeffs, M_PI/2.0);
-fir_filter<float> filtered_elevation(view_filter_coeffs, 0);
+slow_filter<vec3> center_filter(slow_filter_params, vec3(0, 0, 0));
+slow_filter<float> eye_angle_filter(slow_filter_params, M_PI/2.0);
+slow_filter<float> filtered_elevation(slow_filter_params, 0);
 
 double cliff(double distance);
 char float_index(const string &coll, float x);
-Time game_time(view_filter_coeffs);
+Time game_time;
 
 void error_callback(int, const char* msg)
 {
@@ -156,18 +166,48 @@ static const map<char, string> side_texfiles {
 };
 
 // Not space efficient but who cares
-#define CACHE_SIZE (2 * HEX_EXTENT + 4)
-static std::array<std::array<float, CACHE_SIZE>, CACHE_SIZE> tile_cache;
-#undef CACHE_SIZE
+// The cache is a torus indexed by absolute axial coordinates modulo its size,
+// so moving the view only overwrites the slots of hexes that scrolled out.
+#define TILE_CACHE_SIZE (2 * HEX_EXTENT + 4)
+struct TileCache {
+    std::array<std::array<float, TILE_CACHE_SIZE>, TILE_CACHE_SIZE> values;
+    bool valid = false;
+    HexCoord<int> center = {0, 0};
+
+    static int index(int x)
+    {
+        int ret = x % TILE_CACHE_SIZE;
+        return ret < 0 ? ret + TILE_CACHE_SIZE : ret;
+    }
+
+    float at(const HexCoord<int> &coord) const
+    {
+        assert(hex_distance(coord, center) <= HEX_EXTENT + 1);
+        return values[index(coord.q)][index(coord.r)];
+    }
+
+    void freshen(ChunkCache &chunks, HexCoord<int> new_center);
+};
+
+// The render thread only reads the front cache. The terrain worker fills the
+// back cache for the requested center, and tick() swaps them once it's ready.
+static TileCache tile_caches[2];
+static TileCache *tile_cache = &tile_caches[0];
+static struct {
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::thread thread;
+    TileCache *back = &tile_caches[1];
+    HexCoord<int> requested = {0, 0};
+    bool ready = false;
+    bool quit = false;
+} terrain_worker;
 tile_generator tile_gen;
+ChunkCache chunk_cache(&tile_gen, CHUNK_CACHE_BUDGET);
 
 float cached_tile_value(const HexCoord<int> &coord)
 {
-    int q = coord.q - view.center.q + HEX_EXTENT + 1;
-    int r = coord.r - view.center.r + HEX_EXTENT + 1;
-    try {
-    return tile_cache.at(q).at(r);
-    } catch(...) { fprintf(stderr, "%d %d\n",q,r); throw;}
+    return tile_cache->at(coord);
 }
 
 int pushd(const char *path)
@@ -214,46 +254,47 @@ char hex_tile(const string &coll, HexCoord<int> coord)
 }
 
 
-vector<glm::mat4> pines_on_tile(HexCoord<int> coord)
+// Writes up to MAX_PINES_PER_TILE instances to ret, positioned relative to the
+// tile, and returns the count
+int pines_on_tile(HexCoord<int> coord, RenderPost::Instance *ret)
 {
     float elevation = cached_tile_value(coord);
     if (elevation < 0.3 || elevation > 0.7) {
-        return {};
+        return 0;
     }
 
     auto mod = [](float f, int seed, int m) -> float {
         return ((int)(f * seed) % m) / (float)m;
     };
 
-    int count = 3 * mod(elevation, 734877, 7);
+    int count = MAX_PINES_PER_TILE * mod(elevation, 734877, 7);
+    assert(count < MAX_PINES_PER_TILE);
 
-    vector<glm::mat4> ret;
     for (int i = 0; i < count; i++) {
         float e = elevation * i;
         float angle = 2 * M_PI * mod(e, 34989237, 99391);
         float dist = 0.3 + 0.5 * mod(e, 8476397, 17821);
         float s = 0.3 + 0.7 * mod(e, 34249, 948);
-        glm::mat4 scale = glm::scale(glm::vec3(s, s, s));
-        glm::mat4 xlate = glm::translate(glm::vec3(
-            dist * cos(angle), dist * sin(angle), 0));
         float dx = 0.1 * mod(e, 434981, 943);
         float dy = 0.1 * mod(e, 474981, 1543);
         float dz = 1 + 0.1 * mod(e, 348987, 9847);
         float da = 2 * M_PI * mod(e, 9091381, 883);
 
-        glm::mat4 rot = glm::rotate(da, vec3(dx, dy, dz));
-
-        ret.push_back(xlate * scale * rot);
+        ret[i] = RenderPost::Instance::at(vec3(
+            dist * cos(angle), dist * sin(angle), 0));
+        ret[i].scale = s;
+        ret[i].set_rotation(
+            glm::angleAxis(da, glm::normalize(vec3(dx, dy, dz))));
     }
-    return ret;
+    return count;
 }
 
-glm::mat4 step_view_matrix(const tile_generator &tile_gen)
+glm::mat4 step_view_matrix(const tile_generator &tile_gen, float dt)
 {
     // yaw = 0 -> looking up the positive Y-axis
     // yaw is negative because... fudge factor
     float target_angle = -view.yaw * (M_PI / 3.0) + (M_PI / 2.0);
-    float angle = eye_angle_filter.next(target_angle);
+    float angle = eye_angle_filter.next(target_angle, dt);
     Point<double> c = hex_to_pixel(view.center);
     float distance = view.distance.get();
     float pitch = view.pitch.get();
@@ -262,10 +303,10 @@ glm::mat4 step_view_matrix(const tile_generator &tile_gen)
                       distance * sin(pitch));
 
     float view_elevation = hex_elevation(view.center, &tile_gen);
-    float elevation_offset = filtered_elevation.next(view_elevation);
+    float elevation_offset = filtered_elevation.next(view_elevation, dt);
 
     glm::vec3 target_center(c.x, c.y, elevation_offset);
-    vec3 center = center_filter.next(target_center);
+    vec3 center = center_filter.next(target_center, dt);
     view.filtered_center = pixel_to_hex_double(center.x, center.y);
     vec3 eye = center + relative_eye;
 
@@ -295,9 +336,9 @@ vec2 to_vec2(Point<double> p)
     return vec2(p.x, p.y);
 }
 
-vector<HexCoord<int>> hex_range(int n, const HexCoord<int> &center)
+void hex_range(int n, const HexCoord<int> &center, vector<HexCoord<int>> &ret)
 {
-    vector<HexCoord<int>> ret;
+    ret.clear();
     for (int q = -n; q <= n; q++) {
         int start = std::max(-n, -n-q);
         int stop = std::min(n, -q+n);
@@ -305,67 +346,140 @@ vector<HexCoord<int>> hex_range(int n, const HexCoord<int> &center)
             ret.push_back({center.q + q, center.r + r});
         }
     }
+}
+
+vector<HexCoord<int>> hex_range(int n, const HexCoord<int> &center)
+{
+    vector<HexCoord<int>> ret;
+    hex_range(n, center, ret);
     return ret;
 }
 
-vector<HexCoord<int>> visible_hexes()
+// Texture atlas offsets handed to render_post, starting with no offset for
+// unknown tiles, and the top and side indices into them by tile character
+static vector<glm::vec2> tile_offsets = {glm::vec2(0, 0)};
+static std::array<uint8_t, CHAR_MAX> top_tiles;
+static std::array<uint8_t, CHAR_MAX> side_tiles;
+
+static uint8_t tile_index(const string &texfile)
 {
-    // +1 makes the vertically sliding tiles on the margin visible
-    return hex_range(HEX_EXTENT+1, view.center);
+    glm::vec2 offset = hex_textures.offset[texfile];
+    auto it = std::find(tile_offsets.begin(), tile_offsets.end(), offset);
+    if (it != tile_offsets.end()) {
+        return it - tile_offsets.begin();
+    }
+    tile_offsets.push_back(offset);
+    return tile_offsets.size() - 1;
 }
 
-vector<HexCoord<int>> selectable_hexes()
+void init_tile_offsets()
 {
-    // No +1 hides the vertically sliding tiles on the margin
-    return hex_range(HEX_EXTENT, view.center);
+    for (const auto &pair : top_texfiles) {
+        top_tiles[pair.first] = tile_index(pair.second);
+    }
+    for (const auto &pair : side_texfiles) {
+        side_tiles[pair.first] = tile_index(pair.second);
+    }
 }
 
-float min_distance_to_hex(
-    const Ray &ray,
-    const HexCoord<int> coord)
+// These follow the center of the tile cache being drawn, which trails
+// view.center by a frame or two while the terrain worker catches up.
+vector<HexCoord<int>> visible_hexes()
 {
-    vec3 position = hex_position(coord);
-    glm::mat4 mv = view_matrix * glm::translate(glm::mat4(1), position);
-    float ret = INFINITY;
-    for (Triangle triangle : post_triangles) {
-        for (int i = 0; i < 3; i++) {
-            glm::vec4 v = mv * glm::vec4(triangle.vertices[i], 1);
-            triangle.vertices[i] = glm::vec3(v);
-        }
+    // +1 makes the vertically sliding tiles on the margin visible
+    return hex_range(HEX_EXTENT+1, tile_cache->center);
+}
 
-        ret = std::min(ret, ray_intersects_triangle(ray, triangle));
-    }
-    return ret;
+bool is_selectable(const HexCoord<int> &coord)
+{
+    // No +1 hides the vertically sliding tiles on the margin
+    return hex_distance(coord, tile_cache->center) <= HEX_EXTENT;
 }
 
-// TODO measure the cost of this computation. It's a great candidate for
-// threading.
+// The camera never strays far from the center, so a ray that hasn't reached
+// the selectable hexes by then is pointing away from them.
+#define PICK_MAX_STEPS (8 * HEX_EXTENT)
+
 static inline
 HexCoord<int> hex_under_mouse_inner(glm::vec2 mouse)
 {
-    // All mouse calculations are in model-view space, without projection.
+    // Unproject the mouse onto the near and far planes in view space. The
+    // eye is at the origin there, so the far point is also the direction.
     glm::mat4 inv_projection = glm::inverse(proj_matrix);
     glm::vec4 o = inv_projection * glm::vec4{mouse.x, mouse.y, 0, 1};
     glm::vec4 d = inv_projection * glm::vec4{mouse.x, mouse.y, 1, 1};
 
+    glm::mat4 inv_view = glm::inverse(view_matrix);
     Ray ray = {
-        .origin = glm::vec3(o / o.w),
-        .direction = glm::vec3(d / d.w)
+        .origin = glm::vec3(inv_view * (o / o.w)),
+        .direction = glm::vec3(inv_view * glm::vec4(glm::vec3(d / d.w), 0))
     };
 
-    float min_distance = INFINITY;
+    // Posts are prisms filling their hex, so the first one the ray passes
+    // through in the walk is the one under the mouse.
     HexCoord<int> ret {INT_MAX, INT_MAX};
+    bool entered = false;
+    int steps = 0;
+    hex_ray_walk(ray.origin.x, ray.origin.y, ray.direction.x, ray.direction.y,
+        [&](const HexCoord<int> &coord, double t_enter, double t_exit) {
+            if (!is_selectable(coord)) {
+                return !entered && ++steps < PICK_MAX_STEPS;
+            }
+            entered = true;
+
+            // Into the post's own space, where its triangles were prepared
+            mat4 inverse_model = glm::translate(mat4(1), -hex_position(coord));
+            Ray local = transform_ray(inverse_model, ray);
+
+            float z_enter = local.origin.z + t_enter * local.direction.z;
+            float z_exit = local.origin.z + t_exit * local.direction.z;
+            if (std::min(z_enter, z_exit) > post_pick.bounds.hi.z) return true;
+            if (std::max(z_enter, z_exit) < post_pick.bounds.lo.z) return true;
+
+            if (ray_intersects_mesh(local, post_pick) == INFINITY) return true;
+            ret = coord;
+            return false;
+        });
 
-    for (const HexCoord<int>& coord : selectable_hexes()) {
-        float distance = min_distance_to_hex(ray, coord);
+    return ret;
+}
 
-        if (distance < min_distance) {
-            min_distance = distance;
-            ret = coord;
+// Each read from the id buffer keeps the instance order of the frame it was
+// made in, to look the id up in when it's collected. Until a newer read comes
+// in the cursor stays where the last one put it.
+static struct {
+    HexCoord<int> cursor {INT_MAX, INT_MAX};
+    vector<HexCoord<int>> hexes[ID_BUFFER_READBACKS];
+} gpu_pick;
+
+HexCoord<int> gpu_hex_under_mouse()
+{
+    int slot;
+    uint32_t id;
+    if (id_buffer.collect(&slot, &id)) {
+        const vector<HexCoord<int>> &hexes = gpu_pick.hexes[slot];
+        if (id > 0 && id <= hexes.size() && is_selectable(hexes[id - 1])) {
+            gpu_pick.cursor = hexes[id - 1];
+        }
+        else {
+            gpu_pick.cursor = {INT_MAX, INT_MAX};
         }
     }
+    return gpu_pick.cursor;
+}
 
-    return ret;
+// Starts the id buffer read under the mouse for this frame's hexes
+void gpu_pick_read(int w, int h)
+{
+    int window_h = 0, window_w = 0;
+    glfwGetWindowSize(window, &window_w, &window_h);
+    int x = -1, y = -1;
+    if (window_w > 0 && window_h > 0) {
+        x = mouse.x * w / window_w;
+        y = (window_h - mouse.y) * h / window_h;
+    }
+    int slot = id_buffer.read(x, y);
+    std::swap(frame.hexes, gpu_pick.hexes[slot]);
 }
 
 HexCoord<int> hex_under_mouse()
@@ -410,7 +524,7 @@ double cliff(double distance)
 
 void draw()
 {
-    RenderPost::Drawlist hex_drawlist;
+    hex_drawlist.lights.clear();
     hex_drawlist.view = view_matrix;
     hex_drawlist.projection = proj_matrix;
 
@@ -427,71 +541,83 @@ void draw()
         hex_drawlist.lights.put(sun);
     }
 
-    RenderPost::Drawlist pine_drawlist = hex_drawlist;
+    pine_drawlist.view = hex_drawlist.view;
+    pine_drawlist.projection = hex_drawlist.projection;
+    pine_drawlist.lights = hex_drawlist.lights;
     pine_drawlist.use_alpha = true;
+    hex_drawlist.write_ids = true;
 
-    draw_tile_count = 0;
-    //HexCoord<int> cursor = hex_under_mouse();
-    auto& side_items = hex_drawlist.grouped_items["side"];
-    auto& top_items = hex_drawlist.grouped_items["hex_top"];
-    auto& pine_items = pine_drawlist.grouped_items["all"];
+    cursor_drawlist.view = hex_drawlist.view;
+    cursor_drawlist.projection = hex_drawlist.projection;
+    cursor_drawlist.lights = hex_drawlist.lights;
 
-    std::array<glm::vec2, CHAR_MAX> top_offsets;
-    std::array<glm::vec2, CHAR_MAX> side_offsets;
-    for (const auto &pair : top_texfiles) {
-        top_offsets[pair.first] = hex_textures.offset[pair.second];
+    HexCoord<int> cursor =
+        gpu_picking ? gpu_hex_under_mouse() : hex_under_mouse();
+    if (cursor.q == INT_MAX) {
+        render_cursor.begin(cursor_drawlist, 0);
     }
-    for (const auto &pair : side_texfiles) {
-        side_offsets[pair.first] = hex_textures.offset[pair.second];
+    else {
+        // Just above the top of the post so it wins the depth test
+        vec3 position = hex_position(cursor) + vec3(0, 0, 0.01);
+        render_cursor.begin(cursor_drawlist, 1);
+        cursor_drawlist.instances[0] = RenderPost::Instance::at(position);
     }
 
-    for (const HexCoord<int>& coord : visible_hexes()) {
-        RenderPost::Drawlist::Item top, side;
+    hex_range(HEX_EXTENT+1, tile_cache->center, frame.hexes);
+    const size_t n = frame.hexes.size();
+    render_post.begin(hex_drawlist, n);
+    frame.positions.resize(n);
+    frame.visibilities.resize(n);
+    frame.pines.resize(n);
+    frame.pine_counts.resize(n);
+
+    // The drawlist arrays are mapped GPU memory, so anything read back later
+    // goes through the frame scratch arrays instead.
+    parallel_for_hexes(frame.hexes, [](size_t i, const HexCoord<int> &coord) {
         vec3 position = hex_position(coord);
-        mat4 model_matrix = glm::translate(mat4(1), position);
+        frame.positions[i] = position;
+        RenderPost::Instance instance = RenderPost::Instance::at(position);
 
         char top_tile = hex_tile(top_tileset, coord);
-        top.uv_offset = top_offsets[top_tile];
-        top.model_matrix = model_matrix;
+        instance.tiles[top_group] = top_tiles[top_tile];
 
         char side_tile = hex_tile(side_tileset, coord);
-        side.uv_offset = side_offsets[side_tile];
-        side.model_matrix = model_matrix;
+        instance.tiles[side_group] = side_tiles[side_tile];
 
         double distance = hex_distance(
             HexCoord<double>::from(coord),
             view.filtered_center);
-        top.visibility = 1 - cliff(distance);
-        side.visibility = top.visibility;
-
-        /*
-        if (coord.equals(cursor)) {
-            top.material = &cursor_mtl;
-            side.material = &cursor_mtl;
-        }
-        */
+        frame.visibilities[i] = 1 - cliff(distance);
+        instance.set_visibility(frame.visibilities[i]);
+        hex_drawlist.instances[i] = instance;
 
-        top_items.push_back(top);
-        side_items.push_back(side);
-
-        for (const glm::mat4 mat : pines_on_tile(coord)) {
-            RenderPost::Drawlist::Item canopy;
-            canopy.visibility = top.visibility;
-            canopy.uv_offset = {0, 0};
-            canopy.model_matrix = model_matrix * mat;
+        frame.pine_counts[i] = pines_on_tile(coord, frame.pines[i].data());
+    });
 
-            pine_items.push_back(canopy);
+    // Serially, so the pines keep a stable order for blending
+    size_t pine_count = 0;
+    for (size_t i = 0; i < n; i++) {
+        pine_count += frame.pine_counts[i];
+    }
+    render_pine.begin(pine_drawlist, pine_count);
+    size_t pine = 0;
+    for (size_t i = 0; i < n; i++) {
+        for (int k = 0; k < frame.pine_counts[i]; k++, pine++) {
+            RenderPost::Instance instance = frame.pines[i][k];
+            instance.position += frame.positions[i];
+            instance.set_visibility(frame.visibilities[i]);
+            pine_drawlist.instances[pine] = instance;
         }
-
-        draw_tile_count++;
     }
 
+    draw_tile_count = n;
+
     if (enable_shadows) {
         depth_fb.clear();
         Depthmap::Drawlist top, side;
-        for (const auto &item : top_items) {
+        for (const auto &position : frame.positions) {
             Depthmap::Drawlist::Item dm_item;
-            dm_item.model_matrix = item.model_matrix;
+            dm_item.model_matrix = glm::translate(mat4(1), position);
         }
 
         // TODO get rid of this offset
@@ -509,15 +635,27 @@ void draw()
         //pine_drawlist.shadow_view_projection = depthmap.view_projection;
     }
 
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
     int w = 0, h = 0;
     glfwGetFramebufferSize(window, &w, &h);
     glViewport(0, 0, w, h);
-    glDrawBuffer(GL_BACK);
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    if (gpu_picking) {
+        id_buffer.bind(w, h);
+        id_buffer.clear();
+    }
+    else {
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        glDrawBuffer(GL_BACK);
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    }
 
     render_post.draw(hex_drawlist);
+    render_cursor.draw(cursor_drawlist);
     render_pine.draw(pine_drawlist);
+
+    if (gpu_picking) {
+        gpu_pick_read(w, h);
+        id_buffer.blit_to_default();
+    }
 }
 
 /*
@@ -543,29 +681,96 @@ void resize()
     proj_matrix = perspective<float>(fov, aspect, 1, 1e3);
 }
 
-void freshen_tile_cache(const tile_generator &tile_gen)
-{
-    int n = HEX_EXTENT + 1;
-    for (int dq = -n; dq <= n; dq++) {
-        int start = std::max(-n, -n-dq);
-        int stop = std::min(n, -dq+n);
-        for (int dr = start; dr <= stop; dr++) {
-            HexCoord<int> coord;
-            coord.q = view.center.q + dq;
-            coord.r = view.center.r + dr;
-            int q = dq + HEX_EXTENT + 1;
-            int r = dr + HEX_EXTENT + 1;
-            Point<double> center = hex_to_pixel(coord);
-            tile_cache.at(q).at(r) = tile_value(&tile_gen, center.x, center.y);
+// Only evaluates the hexes which were not visible from the previously cached
+// center. For a one hex step that's a thin crescent along the leading edge.
+void TileCache::freshen(ChunkCache &chunks, HexCoord<int> new_center)
+{
+    for (const HexCoord<int> &coord : hex_range(HEX_EXTENT+1, new_center)) {
+        if (!valid || hex_distance(coord, center) > HEX_EXTENT + 1) {
+            values[index(coord.q)][index(coord.r)] = chunks.value(coord);
         }
     }
+
+    valid = true;
+    center = new_center;
+}
+
+static void terrain_worker_main(ChunkCache *chunks)
+{
+    auto &w = terrain_worker;
+    std::unique_lock<std::mutex> lock(w.mutex);
+    HexCoord<int> previous = w.requested;
+    for (;;) {
+        w.wake.wait(lock, [&w] {
+            return w.quit ||
+                (!w.ready && !(w.back->valid && w.back->center.equals(w.requested)));
+        });
+        if (w.quit) break;
+
+        TileCache *cache = w.back;
+        HexCoord<int> center = w.requested;
+        lock.unlock();
+        cache->freshen(*chunks, center);
+        lock.lock();
+        w.ready = true;
+
+        // The swap doesn't wait on this, so get ahead of the player while
+        // the render thread picks up the new cache.
+        HexCoord<int> direction = {
+            (center.q > previous.q) - (center.q < previous.q),
+            (center.r > previous.r) - (center.r < previous.r)
+        };
+        previous = center;
+        lock.unlock();
+        chunks->prefetch(center, direction, HEX_EXTENT + 1);
+        lock.lock();
+    }
+}
+
+void start_terrain_worker(ChunkCache &chunks)
+{
+    terrain_worker.requested = tile_cache->center;
+    terrain_worker.thread = std::thread(terrain_worker_main, &chunks);
+}
+
+void stop_terrain_worker()
+{
+    {
+        std::lock_guard<std::mutex> lock(terrain_worker.mutex);
+        terrain_worker.quit = true;
+    }
+    terrain_worker.wake.notify_one();
+    terrain_worker.thread.join();
+}
+
+void request_terrain(HexCoord<int> center)
+{
+    {
+        std::lock_guard<std::mutex> lock(terrain_worker.mutex);
+        terrain_worker.requested = center;
+    }
+    terrain_worker.wake.notify_one();
+}
+
+// Never blocks on the worker: if it's still busy, keep drawing the old cache.
+void swap_tile_cache()
+{
+    std::unique_lock<std::mutex> lock(terrain_worker.mutex, std::try_to_lock);
+    if (!lock.owns_lock() || !terrain_worker.ready) return;
+
+    terrain_worker.ready = false;
+    if (!terrain_worker.back->center.equals(tile_cache->center)) {
+        std::swap(tile_cache, terrain_worker.back);
+    }
+    lock.unlock();
+    terrain_worker.wake.notify_one();
 }
 
 void move(int n)
 {
     view.center = hex_add(view.center, adjacent_hex(view.yaw + n));
     game_time.advance_hour();
-    freshen_tile_cache(tile_gen);
+    request_terrain(view.center);
 }
 
 void zoom_in() {
@@ -620,6 +825,7 @@ void key_callback(GLFWwindow *, int key, int , int action, int )
             //case GLFW_KEY_F2: depthmap.shrink_texture(); break;
             //case GLFW_KEY_F3: depthmap.grow_texture(); break;
             case GLFW_KEY_F4: enable_shadows ^= 1; break;
+            case GLFW_KEY_F5: gpu_picking ^= 1; break;
         }
     }
 }
@@ -638,12 +844,14 @@ void handle_static_keys()
     if (key_is_pressed(GLFW_KEY_G)) pitch_down();
 }
 
-void tick(const tile_generator &tile_gen)
+// dt is the time in seconds since the last tick
+void tick(const tile_generator &tile_gen, float dt)
 {
-    view.pitch.step();
-    view.distance.step();
-    game_time.step();
-    view_matrix = step_view_matrix(tile_gen);
+    swap_tile_cache();
+    view.pitch.step(dt);
+    view.distance.step(dt);
+    game_time.step(dt);
+    view_matrix = step_view_matrix(tile_gen, dt);
 }
 
 int main()
@@ -685,23 +893,27 @@ int main()
 
     depth_fb.init();
     depthmap.init();
+    id_buffer.init();
     check_gl_error();
 
     Meshes meshes;
-    meshes.post_mesh.init(wf_mesh_from_file("post.obj"));
+    wf_cached_mesh post_obj("post.obj");
+    meshes.post_mesh.init(post_obj.view());
     // These are used for mouse cursor selection
-    post_triangles = wf_triangles_from_file("post.obj");
+    post_pick = PickMesh(wf_triangles(post_obj.view()));
 
-    meshes.pine_mesh.init(wf_mesh_from_file("pine.obj"));
+    meshes.pine_mesh.init(wf_cached_mesh("pine.obj").view());
 
     hex_textures.init("hex_atlas.png", "hex_atlas.png.almanac");
     cursor_mtl = gl3_material::solid_color({1, 0, 0});
     pine_material.init("pine_diffuse.png");
 
+    init_tile_offsets();
     render_post.init(RenderPost::Setup {
         .mesh = &meshes.post_mesh,
         .material = &hex_textures.material,
-        .uv_scale = (float)hex_textures.scale
+        .uv_scale = (float)hex_textures.scale,
+        .tile_offsets = tile_offsets
     });
 
     render_pine.init(RenderPost::Setup {
@@ -710,15 +922,25 @@ int main()
         .uv_scale = 1
     });
 
-    meshes.cursor_mesh.init(wf_mesh_from_file("cursor.obj"));
+    top_group = render_post.group_id("hex_top");
+    side_group = render_post.group_id("side");
+
+    meshes.cursor_mesh.init(wf_cached_mesh("cursor.obj").view());
+    render_cursor.init(RenderPost::Setup {
+        .mesh = &meshes.cursor_mesh,
+        .material = &cursor_mtl,
+        .uv_scale = 1
+    });
     //meshes.lmdebug_mesh.init(wf_mesh_from_file("lmdebug.obj"));
     float harmonics[] = { 7, 2, 1, 2, 3, 1 };
     tile_gen.harmonics = harmonics;
     tile_gen.num_harmonics = ARRAY_COUNT(harmonics);
     tile_gen.feature_size = 40;
     tiles_init(&tile_gen, 123);
+    chunk_cache.persist_to(CHUNK_STORE_DIR);
 
-    freshen_tile_cache(tile_gen);
+    tile_cache->freshen(chunk_cache, view.center);
+    start_terrain_worker(chunk_cache);
 
     struct timeval starttime, frametime;
     float avg_frametime = 16;
@@ -726,6 +948,7 @@ int main()
     int i=0;
 
     glfwSwapBuffers(window);
+    double last_tick = glfwGetTime();
 
     while (!glfwWindowShouldClose(window)) {
         if (gettimeofday(&starttime, NULL) < 0) {
@@ -733,7 +956,9 @@ int main()
         }
         glfwPollEvents();
         handle_static_keys();
-        tick(tile_gen);
+        double now = glfwGetTime();
+        tick(tile_gen, now - last_tick);
+        last_tick = now;
         draw();
         //lmdebug_draw(meshes.lmdebug_mesh);
 
@@ -752,4 +977,6 @@ int main()
         if (i++ % 600 == 0)
             printf("%g tiles -> %g ms\n", avg_tiles_count, avg_frametime);
     }
+
+    stop_terrain_worker();
 }
@@ -1,41 +1,89 @@
 #include "render_post.hpp"
 
+#include <cmath>
+
 #define DIFFUSE_MAP_TEXTURE_INDEX 1
 #define SHADOW_MAP_TEXTURE_INDEX 2
+// Enough for the visible hexes, so the buffers don't grow during startup
+#define INITIAL_INSTANCES 8192
+
+RenderPost::Instance RenderPost::Instance::at(const glm::vec3 &position)
+{
+    Instance ret;
+    ret.position = position;
+    ret.scale = 1;
+    ret.set_rotation(glm::quat(1, 0, 0, 0));
+    ret.visibility = 255;
+    for (uint8_t &tile : ret.tiles) tile = 0;
+    return ret;
+}
+
+void RenderPost::Instance::set_rotation(const glm::quat &q)
+{
+    const float xyzw[4] = { q.x, q.y, q.z, q.w };
+    for (int i = 0; i < 4; i++) {
+        rotation[i] = std::round(glm::clamp(xyzw[i], -1.0f, 1.0f) * 32767);
+    }
+}
+
+void RenderPost::Instance::set_visibility(float v)
+{
+    visibility = std::round(glm::clamp(v, 0.0f, 1.0f) * 255);
+}
 
 void RenderPost::init(const RenderPost::Setup setup)
 {
+    static_assert(sizeof(Instance) == 28, "RenderPost::Instance isn't packed");
     program = load_program("render_post.vert", "render_post.frag");
     uv_scale = setup.uv_scale;
     material = setup.material;
+    tile_offset_values = setup.tile_offsets;
     assert(program);
+    if (setup.mesh->groups.size() > RENDER_POST_MAX_GROUPS ||
+        tile_offset_values.empty() ||
+        tile_offset_values.size() > RENDER_POST_MAX_TILES) {
+        fprintf(stderr, "Too many groups or tiles for RenderPost: %zu, %zu\n",
+                setup.mesh->groups.size(), tile_offset_values.size());
+        abort();
+    }
 
-    vertex.init(program, "vertex", 4);
-    normal.init(program, "normal", 3);
-    uv.init(program, "vertex_uv", 2);
-    model_matrix.init(program, "model_matrix");
-    model_matrix.instanced = true;
-    visibility.init(program, "visibility", 1);
-    visibility.instanced = true;
-    uv_offset.init(program, "uv_offset", 2);
-    uv_offset.instanced = true;
+    vertex.init(program, "vertex", 3, GL_FLOAT, false,
+                sizeof(gl3_vertex), offsetof(gl3_vertex, position));
+    normal.init(program, "normal", 4, GL_INT_2_10_10_10_REV, true,
+                sizeof(gl3_vertex), offsetof(gl3_vertex, normal));
+    uv.init(program, "vertex_uv", 2, GL_HALF_FLOAT, false,
+            sizeof(gl3_vertex), offsetof(gl3_vertex, uv));
+    // Position and scale together make a vec4
+    instance_position.init(program, "instance_position", 4, GL_FLOAT, false,
+                           sizeof(Instance), offsetof(Instance, position));
+    instance_position.instanced = true;
+    instance_rotation.init(program, "instance_rotation", 4, GL_SHORT, true,
+                           sizeof(Instance), offsetof(Instance, rotation));
+    instance_rotation.instanced = true;
+    instance_packed.init(program, "instance_packed", 4, GL_UNSIGNED_BYTE,
+                         false, sizeof(Instance),
+                         offsetof(Instance, visibility));
+    instance_packed.integer = true;
+    instance_packed.instanced = true;
 
     view_matrix.init(program, "view_matrix");
+    normal_view_matrix.init(program, "normal_view_matrix");
     projection_matrix.init(program, "projection_matrix");
     //shadow_view_projection_matrix.init(program, "shadow_view_projection_matrix");
     //shadow_map.init(program, "shadow_map");
 
     diffuse_map.init(program, "diffuse_map");
     shader_uv_scale.init(program, "uv_scale");
+    tile_slot.init(program, "tile_slot");
+    tile_offsets.init(program, "tile_offsets");
 
     num_lights.init(program, "num_lights");
     light_vec.init(program, "light_vec");
     light_color.init(program, "light_color");
 
-    model_matrix_buffer.init({}, true);
-    visibility_buffer.init({}, true);
-    uv_offset_buffer.init({}, true);
+    instance_buffer.init(INITIAL_INSTANCES);
 
+    // Instance attributes are pointed at the current ring region in draw()
     for (const auto &pair : setup.mesh->groups) {
         PerGroupData d;
         d.vao.init();
@@ -43,22 +91,35 @@ void RenderPost::init(const RenderPost::Setup setup)
         d.count = pair.second.count;
 
         vertex.point_to(setup.mesh->vertex_buffer);
-        normal.point_to(setup.mesh->normal_buffer);
-        uv.point_to(setup.mesh->uv_buffer);
-        model_matrix.point_to(model_matrix_buffer);
-        visibility.point_to(visibility_buffer);
-        uv_offset.point_to(uv_offset_buffer);
+        normal.point_to(setup.mesh->vertex_buffer);
+        uv.point_to(setup.mesh->vertex_buffer);
 
         d.indices = &pair.second;
 
         d.vao.unbind();
 
-        groups[pair.first] = d;
+        group_ids[pair.first] = groups.size();
+        groups.push_back(d);
     }
 
     check_gl_error();
 }
 
+int RenderPost::group_id(const std::string &name) const
+{
+    if (!group_ids.count(name)) {
+        fprintf(stderr, "No such group: %s\n", name.c_str());
+        abort();
+    }
+    return group_ids.at(name);
+}
+
+void RenderPost::begin(RenderPost::Drawlist &drawlist, size_t count)
+{
+    drawlist.count = count;
+    drawlist.instances = instance_buffer.map(count);
+}
+
 void RenderPost::draw(const RenderPost::Drawlist &drawlist)
 {
     check_gl_error();
@@ -69,6 +130,8 @@ void RenderPost::draw(const RenderPost::Drawlist &drawlist)
         glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
     }
     glDepthFunc(GL_LESS);
+    GLboolean ids = drawlist.write_ids;
+    glColorMaski(1, ids, ids, ids, ids);
     glUseProgram(program);
     material->activate(DIFFUSE_MAP_TEXTURE_INDEX);
     check_gl_error();
@@ -87,40 +150,33 @@ void RenderPost::draw(const RenderPost::Drawlist &drawlist)
     diffuse_map.set(DIFFUSE_MAP_TEXTURE_INDEX);
 
     view_matrix.set(drawlist.view);
+    // Instances only rotate and scale uniformly, so only the view needs the
+    // inverse transpose, once per draw rather than once per vertex
+    normal_view_matrix.set(
+        glm::transpose(glm::inverse(glm::mat3(drawlist.view))));
     projection_matrix.set(drawlist.projection);
     shader_uv_scale.set(uv_scale);
+    tile_offsets.set(tile_offset_values);
 
-    std::vector<glm::mat4> model_matrices;
-    std::vector<float> visibilities;
-    for (const auto &pair : drawlist.grouped_items) {
-        for (const auto &item : pair.second) {
-            model_matrices.push_back(item.model_matrix);
-            visibilities.push_back(item.visibility);
-        }
-        break;
-    }
-
-    model_matrix_buffer.buffer_data_dynamic(model_matrices);
-    visibility_buffer.buffer_data_dynamic(visibilities);
-
-    for (const auto &pair : drawlist.grouped_items) {
-        std::vector<glm::vec2> uv_offsets;
-
-        // TODO buffer directly instead of copying
-        for (const auto &item : pair.second) {
-            uv_offsets.push_back(item.uv_offset);
-        }
-
-        uv_offset_buffer.buffer_data_dynamic(uv_offsets);
+    instance_buffer.unmap();
 
+    for (size_t id = 0; id < groups.size(); id++) {
         //shadow_view_projection_matrix.set(drawlist.shadow_view_projection);
+        PerGroupData &render_group = groups[id];
 
-        const auto &render_group = groups[pair.first];
         render_group.vao.bind();
+        instance_position.point_to(instance_buffer, instance_buffer.offset);
+        instance_rotation.point_to(instance_buffer, instance_buffer.offset);
+        instance_packed.point_to(instance_buffer, instance_buffer.offset);
+        tile_slot.set(id);
         render_group.indices->bind_elements();
-        render_group.indices->draw_instanced(model_matrices.size());
+        if (drawlist.size()) {
+            render_group.indices->draw_instanced(drawlist.size());
+        }
     }
 
+    instance_buffer.fence();
+
     //VertexArrayObject::unbind();
 
     if (drawlist.use_alpha) {
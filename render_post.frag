@@ -14,8 +14,11 @@ in vec2 uv;
 in float elevation;
 //in vec4 shadow_coord;
 in vec2 uv_offset_frag;
+flat in uint instance_id_frag;
 
-out vec4 color;
+layout(location = 0) out vec4 color;
+// Only lands anywhere when drawing into an IdBuffer
+layout(location = 1) out uint instance_id;
 
 const float ambient_min = 0.2;
 const float ambient_max = 0.4;
@@ -73,4 +76,5 @@ void main()
                light *
                clamp(visibility_frag, 0, 1);
     color = vec4(rgb, tex_value.a);
+    instance_id = instance_id_frag;
 }
@@ -3,11 +3,37 @@
 #include "gl3.hpp"
 #include "atlas.hpp"
 
+#include <glm/gtc/quaternion.hpp>
+
+#define RENDER_POST_MAX_GROUPS 3
+// Has to match the size of tile_offsets in render_post.vert
+#define RENDER_POST_MAX_TILES 64
+
 struct RenderPost {
     struct Setup {
         const gl3_mesh *mesh;
         const gl3_material *material;
         float uv_scale;
+        // Texture atlas offsets, which instances pick from per group
+        std::vector<glm::vec2> tile_offsets = {glm::vec2(0, 0)};
+    };
+
+    /* Everything drawn per instance, in 28 bytes. The model matrix is
+     * translate(position) * scale(scale) * rotation, with rotation a unit
+     * quaternion packed as snorm16 x, y, z, w. visibility is a unorm8, and
+     * tiles[group_id] is the index of the group's uv offset in
+     * Setup::tile_offsets. */
+    struct Instance {
+        glm::vec3 position;
+        float scale;
+        int16_t rotation[4];
+        uint8_t visibility;
+        uint8_t tiles[RENDER_POST_MAX_GROUPS];
+
+        // Unscaled, unrotated and fully visible, with the first tiles
+        static Instance at(const glm::vec3 &position);
+        void set_rotation(const glm::quat &q);
+        void set_visibility(float v);
     };
 
     struct Drawlist { 
@@ -17,21 +43,29 @@ struct RenderPost {
 
         GLuint depth_map = UINT_MAX;
         bool use_alpha = false;
+        // Whether instances write their ids when drawing into an IdBuffer
+        bool write_ids = false;
 
-        struct Item {
-            glm::vec2 uv_offset;
-            glm::mat4 model_matrix;
-            float visibility;
-        };
-
-        std::map<std::string, std::vector<Item>> grouped_items;
+        // One entry per instance, pointing straight into a mapped buffer
+        // after RenderPost::begin(). It's write only: reading mapped memory
+        // back is very slow, so fill an Instance and store it whole. Every
+        // group of the mesh draws the same instances.
+        size_t count = 0;
+        Instance *instances = NULL;
 
         Lights lights;
+
+        size_t size() const { return count; }
     };
 
     void init(const Setup setup);
+    // Maps this frame's instance buffer for count instances into drawlist
+    void begin(RenderPost::Drawlist &drawlist, size_t count);
     void draw(const RenderPost::Drawlist &drawlist);
 
+    int group_id(const std::string &name) const;
+    size_t group_count() const { return groups.size(); }
+
 private:
     struct PerGroupData {
         VertexArrayObject vao;
@@ -44,28 +78,30 @@ private:
     VertexAttribArray vertex;
     VertexAttribArray normal;
     VertexAttribArray uv;
-    VertexAttribArrayMat4 model_matrix;
-    VertexAttribArray visibility;
-    VertexAttribArray uv_offset;
+    VertexAttribArray instance_position;
+    VertexAttribArray instance_rotation;
+    VertexAttribArray instance_packed;
 
     UniformMat4 view_matrix;
+    UniformMat3 normal_view_matrix;
     UniformMat4 projection_matrix;
     UniformMat4 shadow_view_projection_matrix;
 
     UniformInt diffuse_map;
     UniformInt shadow_map;
     UniformFloat shader_uv_scale;
+    UniformInt tile_slot;
+    UniformVec2Vec tile_offsets;
 
     UniformInt num_lights;
     UniformVec3Vec light_vec;
     UniformVec3Vec light_color;
 
-    ArrayBuffer<glm::mat4> model_matrix_buffer;
-    ArrayBuffer<float> visibility_buffer;
-    ArrayBuffer<glm::vec2> uv_offset_buffer;
+    StreamingArrayBuffer<Instance> instance_buffer;
 
-    size_t group_count;
     float uv_scale;
-    std::map<std::string, PerGroupData> groups;
+    std::vector<glm::vec2> tile_offset_values;
+    std::vector<PerGroupData> groups;
+    std::map<std::string, int> group_ids;
     const gl3_material *material;
 };
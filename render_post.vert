@@ -1,16 +1,23 @@
 #version 330 core
 
 uniform mat4 view_matrix;
+// transpose(inverse(mat3(view_matrix)))
+uniform mat3 normal_view_matrix;
 uniform mat4 projection_matrix;
 //uniform mat4 shadow_view_projection_matrix;
+// Which byte of instance_packed.yzw holds this group's tile
+uniform int tile_slot;
+uniform vec2 tile_offsets[64];
 
 in vec4 vertex;
 in vec3 normal;
 in vec2 vertex_uv;
-in float visibility;
-in vec3 position;
-in vec2 uv_offset;
-in mat4 model_matrix;
+// xyz position, w uniform scale
+in vec4 instance_position;
+// Unit quaternion, xyz then w
+in vec4 instance_rotation;
+// Visibility, then the tile of each group
+in uvec4 instance_packed;
 
 out vec2 uv;
 out float elevation;
@@ -18,18 +25,28 @@ out vec3 normal_frag;
 //out vec4 shadow_coord;
 out float visibility_frag;
 out vec2 uv_offset_frag;
+flat out uint instance_id_frag;
+
+vec3 rotate(vec4 q, vec3 v)
+{
+    return v + 2.0 * cross(q.xyz, cross(q.xyz, v) + q.w * v);
+}
 
 void main()
 {
-    mat4 MVP = projection_matrix * view_matrix * model_matrix;
-    mat3 normal_matrix = mat3(transpose(inverse(view_matrix * model_matrix)));
-    //mat4 shadow_MVP = shadow_view_projection_matrix * model_matrix;
+    // Renormalized since it was quantized to 16 bits
+    vec4 rotation = normalize(instance_rotation);
+    vec3 world = instance_position.xyz +
+                 instance_position.w * rotate(rotation, vertex.xyz);
 
-    gl_Position = MVP * vertex;
+    gl_Position = projection_matrix * view_matrix * vec4(world, 1);
     elevation = vertex.z;
     uv = vertex_uv;
-    uv_offset_frag = uv_offset;
-    normal_frag = normal_matrix * normal;
-    //shadow_coord = shadow_MVP * vertex;
-    visibility_frag = visibility;
+    uv_offset_frag = tile_offsets[instance_packed[1 + tile_slot]];
+    // Uniform scale only changes the length, and the fragment shader
+    // normalizes anyway
+    normal_frag = normal_view_matrix * rotate(rotation, normal);
+    //shadow_coord = shadow_view_projection_matrix * vec4(world, 1);
+    visibility_frag = float(instance_packed.x) / 255.0;
+    instance_id_frag = uint(gl_InstanceID) + 1u;
 }
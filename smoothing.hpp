@@ -0,0 +1,59 @@
+#pragma once
+#include <cmath>
+
+#include "fir_filter.hpp"
+
+/* Critically damped spring pulling towards the latest input. Each step solves
+ * the spring exactly over dt, so it moves at the same speed at any frame rate
+ * and stays stable however long the frame. The state is just a position and
+ * a velocity. half_time is how long it takes to close half of a sudden gap.
+ */
+template<typename T>
+class spring_filter {
+    float omega;
+    T position, velocity;
+
+public:
+    typedef float params_type;
+
+    spring_filter(float half_time, const T &initial_value)
+    // 1 - (1 + x) exp(-x) crosses 1/2 at x = 1.678
+    : omega(1.678 / half_time)
+    , position(initial_value)
+    , velocity(initial_value * 0.0f)
+    {
+    }
+
+    T next(const T &x, float dt) {
+        T offset = position - x;
+        T j = velocity + omega * offset;
+        float decay = std::exp(-omega * dt);
+        position = x + (offset + j * dt) * decay;
+        velocity = (velocity - j * (omega * dt)) * decay;
+        return position;
+    }
+
+    T get() const { return position; }
+};
+
+/* The camera and the clock smooth their motion with springs by default.
+ * Defining FIR_SMOOTHING, which make SMOOTHING=fir does, switches them back to
+ * the FIR filters. Those settle over a fixed number of frames instead of a
+ * fixed time. The springs' half times match the FIRs' delays at 60 frames
+ * per second.
+ */
+#ifdef FIR_SMOOTHING
+#define SLOW_FILTER_TAPS 20
+#define FAST_FILTER_TAPS 10
+template<typename T> using slow_filter = fir_filter<T, SLOW_FILTER_TAPS>;
+template<typename T> using fast_filter = fir_filter<T, FAST_FILTER_TAPS>;
+constexpr std::array<float, SLOW_FILTER_TAPS> slow_filter_params =
+    firwin<SLOW_FILTER_TAPS>(0.01);
+constexpr std::array<float, FAST_FILTER_TAPS> fast_filter_params =
+    firwin<FAST_FILTER_TAPS>(0.01);
+#else
+template<typename T> using slow_filter = spring_filter<T>;
+template<typename T> using fast_filter = spring_filter<T>;
+constexpr float slow_filter_params = 9.5 / 60;
+constexpr float fast_filter_params = 4.5 / 60;
+#endif
@@ -24,6 +24,9 @@ cal_tiles(&gen, 1000, 1000);
 #define MAX(x, y) ((x) >= (y) ? (x) : (y))
 #define CLAMP(x, lil, big) MAX(MIN(big, x), lil)
 
+/* Samples per side of the grid tiles_init normalizes over */
+#define CALIBRATION_GRID 160
+
 static
 float uncomp_noise(const tile_generator *gen, float x, float y)
 {
@@ -48,9 +51,59 @@ float tile_value(const tile_generator *gen, float x, float y)
     return (a - gen->_offset) * gen->_gain;
 }
 
+/* Points are evaluated in blocks, octave by octave, so the harmonic weights
+ * and frequencies are computed once per block instead of once per point, and
+ * each octave goes through the SIMD noise kernel. The sum runs in the same
+ * order as uncomp_noise so results match tile_value. */
+#define TILE_BLOCK 256
+
+void tile_values(const tile_generator *gen,
+                 const float *xs, const float *ys, float *out, size_t n)
+{
+    double divisor = 0;
+    for (int i = 0; i < gen->num_harmonics; i++) {
+        divisor += gen->harmonics[i];
+    }
+
+    float x[TILE_BLOCK], y[TILE_BLOCK];
+    double xf[TILE_BLOCK], yf[TILE_BLOCK], noise[TILE_BLOCK];
+    double acc[TILE_BLOCK];
+
+    for (size_t start = 0; start < n; start += TILE_BLOCK) {
+        size_t count = MIN(n - start, TILE_BLOCK);
+
+        for (size_t k = 0; k < count; k++) {
+            x[k] = xs[start + k] / gen->feature_size;
+            y[k] = ys[start + k] / gen->feature_size;
+            acc[k] = 0;
+        }
+
+        for (int i = 0; i < gen->num_harmonics; i++) {
+            double h = gen->harmonics[i];
+            int f = 2 << i;
+            for (size_t k = 0; k < count; k++) {
+                xf[k] = x[k] * f;
+                yf[k] = y[k] * f;
+            }
+            open_simplex_noise2_batch(gen->osn, xf, yf, noise, count);
+            for (size_t k = 0; k < count; k++) {
+                acc[k] += noise[k] * h;
+            }
+        }
+
+        for (size_t k = 0; k < count; k++) {
+            float a = acc[k] / divisor;
+            out[start + k] = (a - gen->_offset) * gen->_gain;
+        }
+    }
+}
+
+#undef TILE_BLOCK
+
 void tiles_init(tile_generator *gen, int64_t seed)
 {
     open_simplex_noise(seed, &gen->osn);
+    gen->_seed = seed;
 
     float max_value = -INFINITY;
     float min_value = INFINITY;
@@ -58,11 +111,23 @@ void tiles_init(tile_generator *gen, int64_t seed)
     gen->_gain = 1;
     gen->_offset = 0;
 
-    for (int i = 0; i < 4 * gen->feature_size; i++) {
-        for (int k = 0; k < 4 * gen->feature_size; k++) {
-            float x = uncomp_noise(gen, i, k);
-            max_value = MAX(x, max_value);
-            min_value = MIN(x, min_value);
+    /* Sample a 4x4 feature square on a fixed grid, so startup time doesn't
+     * grow with feature_size. A feature_size of 40 samples every unit, the
+     * same as the old one sample per unit sweep. */
+    float step = 4 * gen->feature_size / CALIBRATION_GRID;
+    float xs[CALIBRATION_GRID], ys[CALIBRATION_GRID], row[CALIBRATION_GRID];
+    for (int k = 0; k < CALIBRATION_GRID; k++) {
+        ys[k] = k * step;
+    }
+
+    for (int i = 0; i < CALIBRATION_GRID; i++) {
+        for (int k = 0; k < CALIBRATION_GRID; k++) {
+            xs[k] = i * step;
+        }
+        tile_values(gen, xs, ys, row, CALIBRATION_GRID);
+        for (int k = 0; k < CALIBRATION_GRID; k++) {
+            max_value = MAX(row[k], max_value);
+            min_value = MIN(row[k], min_value);
         }
     }
 
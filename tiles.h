@@ -1,8 +1,11 @@
+#pragma once
+
 typedef struct {
     float *harmonics;
     int num_harmonics;
     float feature_size;
     struct osn_context *osn;
+    int64_t _seed;
     float _offset;
     float _gain;
     /* TODO
@@ -12,4 +15,7 @@ typedef struct {
 } tile_generator;
 
 float tile_value(const tile_generator *gen, float x, float y);
+/* Same as tile_value for each of the n points (xs[i], ys[i]) */
+void tile_values(const tile_generator *gen,
+                 const float *xs, const float *ys, float *out, size_t n);
 void tiles_init(tile_generator *gen, int64_t seed);
@@ -25,9 +25,9 @@ void Time::advance_hour()
     }
 }
 
-void Time::step()
+void Time::step(float dt)
 {
-    filter.next(vec());
+    filter.next(vec(), dt);
 }
 
 float Time::fractional_day() const
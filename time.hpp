@@ -1,21 +1,21 @@
 #pragma once
 #define GLM_FORCE_RADIANS
 #include <glm/glm.hpp>
-#include "fir_filter.hpp"
+#include "smoothing.hpp"
 
 class Time {
     int time_of_day = 0;
     int day_of_year = 0;
     int year = 0;
-    fir_filter<glm::vec2> filter;
+    slow_filter<glm::vec2> filter;
     glm::vec2 vec() const;
 
 public:
-    explicit Time(const std::vector<float> coeffs)
-        : filter(coeffs, vec())
+    Time()
+        : filter(slow_filter_params, vec())
         {}
     void advance_hour();
-    void step();
+    void step(float dt);
 
     float fractional_day() const;
     float fractional_night() const;
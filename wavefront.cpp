@@ -19,16 +19,30 @@
 
 #include <cstdio>
 #include <cassert>
+#include <cmath>
 #include <cstring>
 #include <cctype>
+#include <cstdint>
+#include <cstdlib>
 
 #include <string>
 #include <set>
 #include <map>
 #include <tuple>
+#include <array>
+#include <unordered_map>
+
+extern "C" {
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+}
 
 #include "wavefront.hpp"
 
+#include <glm/gtc/packing.hpp>
+
 using std::vector;
 using std::set;
 using std::map;
@@ -58,6 +72,29 @@ struct Face {
     int group;
 };
 
+// One line of the file, which isn't NUL terminated. The reads mirror the
+// sscanf conversions the parser used to be written with: they skip leading
+// whitespace and stop at the first character that doesn't fit.
+struct Cursor {
+    const char *p, *end;
+
+    bool at_end() const { return p >= end; }
+    bool peek(char c) const { return p < end && *p == c; }
+    string rest() const { return string(p, end); }
+
+    void skip_space() { while (p < end && isspace(*p)) p++; }
+    void skip_token() { while (p < end && !isspace(*p)) p++; }
+
+    bool starts_with(const char *s) const
+    {
+        size_t n = strlen(s);
+        return (size_t)(end - p) >= n && !memcmp(p, s, n);
+    }
+
+    bool read_int(int *ret);
+    bool read_float(float *ret);
+};
+
 struct Parse {
     vector<vec4> vertices;
     vector<vec3> normals;
@@ -65,28 +102,30 @@ struct Parse {
     vector<Face> faces;
     vector<string> materials = {""};
     vector<string> mtllibs;
-    map<int, vector<int>> vert_to_faces;
+    // Compressed vertex to face corner adjacency, built by smooth_normals():
+    // the corners 3*face+corner using vertex v are
+    // vertex_corners[vertex_corner_offsets[v]..vertex_corner_offsets[v+1]]
+    vector<int> vertex_corner_offsets;
+    vector<int> vertex_corners;
     vector<string> geometry_groups = {""};
     int smoothing_group = -1;
     int geometry_group = 0;
     int material_index = 0;
-    int read_face_token(const char *, FaceToken *);
-    int parse_face(const char *);
-    int parse_group(const char *);
-    int parse_vertex(const char *);
-    int parse_normal(const char *);
-    int parse_texture(const char *);
-    int parse_error(const char *);
-    int parse_smoothing_group(const char *);
-    int parse_use_material(const char *);
-    int parse_mtllib(const char *);
-    int which_corner(const Face &face, int vertex_index) const;
+    int read_face_token(Cursor, FaceToken *);
+    int parse_face(Cursor);
+    int parse_group(Cursor);
+    int parse_vertex(Cursor);
+    int parse_normal(Cursor);
+    int parse_texture(Cursor);
+    int parse_error(Cursor);
+    int parse_smoothing_group(Cursor);
+    int parse_use_material(Cursor);
+    int parse_mtllib(Cursor);
     vec4 face_vector(const Face &face, int from, int to) const;
-    float angle_at_corner(const Face &face, int vertex_index) const;
+    void corner_angles(const Face &face, float angles[3]) const;
 
     vec3 face_normal(const Face &) const;
-    vec3 smooth_normal(int smoothing_group, int vertex_index) const;
-    void smooth_face_normals(Face &face);
+    void build_adjacency();
     void smooth_normals();
 };
 
@@ -96,28 +135,125 @@ int index_of(const string &s, const vector<string> &v)
     return -1;
 }
 
-int Parse::read_face_token(const char *token, FaceToken *face) {
+bool Cursor::read_int(int *ret)
+{
+    skip_space();
+    const char *s = p;
+    bool negative = false;
+    if (s < end && (*s == '-' || *s == '+')) negative = *s++ == '-';
+    if (s >= end || !isdigit(*s)) return false;
+
+    int value = 0;
+    while (s < end && isdigit(*s)) value = 10 * value + (*s++ - '0');
+    *ret = negative ? -value : value;
+    p = s;
+    return true;
+}
+
+// Powers of ten which are exact as floats
+static const float exact_pow10[] = {
+    1e0f, 1e1f, 1e2f, 1e3f, 1e4f, 1e5f, 1e6f, 1e7f, 1e8f, 1e9f, 1e10f
+};
+#define MAX_EXACT_POW10 10
+#define MAX_EXACT_MANTISSA (1 << 24)
+#define MAX_FLOAT_TOKEN 64
+
+bool Cursor::read_float(float *ret)
+{
+    skip_space();
+    const char *s = p;
+    bool negative = false;
+    if (s < end && (*s == '-' || *s == '+')) negative = *s++ == '-';
+
+    // Plain decimals whose digits and power of ten are both exact as floats
+    // come out correctly rounded from a single multiply or divide, the same
+    // as strtof. Everything else goes to strtof.
+    uint64_t mantissa = 0;
+    int digits = 0, exponent = 0;
+    while (s < end && isdigit(*s) && digits < 18) {
+        mantissa = 10 * mantissa + (*s++ - '0');
+        digits++;
+    }
+    if (s < end && *s == '.') {
+        s++;
+        while (s < end && isdigit(*s) && digits < 18) {
+            mantissa = 10 * mantissa + (*s++ - '0');
+            digits++;
+            exponent--;
+        }
+    }
+    if (s < end && (*s == 'e' || *s == 'E')) {
+        const char *e = s + 1;
+        bool negative_exponent = false;
+        if (e < end && (*e == '-' || *e == '+')) {
+            negative_exponent = *e++ == '-';
+        }
+        int n = 0;
+        if (e < end && isdigit(*e)) {
+            while (e < end && isdigit(*e) && n < 1000) n = 10 * n + (*e++ - '0');
+            exponent += negative_exponent ? -n : n;
+            s = e;
+        }
+    }
+
+    bool simple = digits > 0 && digits < 18 &&
+                  (s >= end || !isalnum(*s)) &&
+                  mantissa <= MAX_EXACT_MANTISSA &&
+                  std::abs(exponent) <= MAX_EXACT_POW10;
+    if (simple) {
+        float value = mantissa;
+        if (exponent < 0) value /= exact_pow10[-exponent];
+        else value *= exact_pow10[exponent];
+        *ret = negative ? -value : value;
+        p = s;
+        return true;
+    }
+
+    char buf[MAX_FLOAT_TOKEN];
+    size_t n = 0;
+    while (p + n < end && !isspace(p[n]) && n + 1 < sizeof(buf)) {
+        buf[n] = p[n];
+        n++;
+    }
+    buf[n] = 0;
+    char *stop;
+    float value = strtof(buf, &stop);
+    if (stop == buf) return false;
+    *ret = value;
+    p += stop - buf;
+    return true;
+}
+
+// One of "v", "v/t", "v//n" or "v/t/n"
+int Parse::read_face_token(Cursor c, FaceToken *face) {
     face->v = 0;
     face->t = 0;
     face->n = 0;
-    if (3 == sscanf(token, "%d/%d/%d", &face->v, &face->t, &face->n)) {
-    }
-    else if (2 == sscanf(token, "%d//%d", &face->v, &face->n)) {
-    }
-    else if (2 == sscanf(token, "%d/%d", &face->v, &face->t)) {
-    }
-    else if (1 == sscanf(token, "%d", &face->v)) {
-    }
-    else {
-        fprintf(stderr, "Invalid face: '%s'\n", token);
+    if (!c.read_int(&face->v)) {
+        fprintf(stderr, "Invalid face: '%s'\n", c.rest().c_str());
         return 0;
     }
+    if (c.peek('/')) {
+        c.p++;
+        if (c.peek('/')) {
+            c.p++;
+            c.read_int(&face->n);
+        }
+        else {
+            c.read_int(&face->t);
+            if (c.peek('/')) {
+                c.p++;
+                c.read_int(&face->n);
+            }
+        }
+    }
+
     // Negative numbers have to be handled in the middle of parsing because -1
     // refers to the most recently defined vertex/texture/normal, not the last
     // one in the file.
-    if (face->v < 0) face->v += vertices.size();
-    if (face->t < 0) face->t += textures.size();
-    if (face->n < 0) face->n += normals.size();
+    if (face->v < 0) face->v += vertices.size() + 1;
+    if (face->t < 0) face->t += textures.size() + 1;
+    if (face->n < 0) face->n += normals.size() + 1;
 
     // Convert 1-indexed element indices to zero-indexed C indices
     face->v--;
@@ -149,23 +285,17 @@ vector<Face> triangulate_face(vector<FaceToken> untri) {
     return ret;
 }
 
-static
-const char *next_token(const char *s) {
-    while (*s && !isspace(*s)) s++;
-    while (*s && isspace(*s)) s++;
-    return s;
-}
-
-int Parse::parse_face(const char *token) {
+int Parse::parse_face(Cursor c) {
     vector<FaceToken> facetoks;
-    if (token[0] == 'f' && isspace(token[1])) {
+    if (c.peek('f') && c.p + 1 < c.end && isspace(c.p[1])) {
         FaceToken facetok;
-        while (*token) {
-            token = next_token(token);
-            if (*token) {
-                if (read_face_token(token, &facetok)) {
-                    facetoks.push_back(facetok);
-                }
+        c.p++;
+        for (c.skip_space(); !c.at_end(); c.skip_space()) {
+            Cursor token = { c.p, c.end };
+            c.skip_token();
+            token.end = c.p;
+            if (read_face_token(token, &facetok)) {
+                facetoks.push_back(facetok);
             }
         }
 
@@ -173,10 +303,6 @@ int Parse::parse_face(const char *token) {
             face.smooth = smoothing_group;
             face.material = material_index;
             face.group = geometry_group;
-            int face_index = faces.size();
-            for (int i = 0; i < 3; i++) {
-                vert_to_faces[face.vertex_indices[i]].push_back(face_index);
-            }
             faces.push_back(face);
         }
 
@@ -187,21 +313,15 @@ int Parse::parse_face(const char *token) {
     }
 }
 
-static
-const char *strip_left(const char *line) {
-    while (*line == ' ' || *line == '\t') line++;
-    return line;
+static void skip_blank(Cursor &c) {
+    while (c.p < c.end && (*c.p == ' ' || *c.p == '\t')) c.p++;
 }
 
-static
-void strip_right(char *line) {
-    while (*line && *line != '\n') line++;
-    *line = 0;
-}
-
-int Parse::parse_group(const char *line) {
-    if (line[0] == 'g') {
-        const string group = strip_left(line+1);
+int Parse::parse_group(Cursor c) {
+    if (c.peek('g')) {
+        c.p++;
+        skip_blank(c);
+        const string group = c.rest();
         geometry_group = index_of(group, geometry_groups);
         if (geometry_group < 0) {
             geometry_group = geometry_groups.size();
@@ -214,24 +334,25 @@ int Parse::parse_group(const char *line) {
     }
 }
 
-int Parse::parse_vertex(const char *line) {
+int Parse::parse_vertex(Cursor c) {
     float x, y, z, w;
     w = 1.0f;
-    if (4 == sscanf(line, "v %f %f %f %f", &x, &y, &z, &w)) {
-    }
-    else if (3 == sscanf(line, "v %f %f %f", &x, &y, &z)) {
-    }
-    else {
+    if (!c.peek('v')) return 0;
+    c.p++;
+    if (!c.read_float(&x) || !c.read_float(&y) || !c.read_float(&z)) {
         return 0;
     }
+    c.read_float(&w);
 
     vertices.push_back(vec4(x, y, z, w));
     return 1;
 }
 
-int Parse::parse_normal(const char *line) {
+int Parse::parse_normal(Cursor c) {
     float x, y, z;
-    if (3 == sscanf(line, "vn %f %f %f", &x, &y, &z)) {
+    if (!c.starts_with("vn")) return 0;
+    c.p += 2;
+    if (c.read_float(&x) && c.read_float(&y) && c.read_float(&z)) {
         normals.push_back(vec3(x, y, z));
         return 1;
     }
@@ -240,9 +361,11 @@ int Parse::parse_normal(const char *line) {
     }
 }
 
-int Parse::parse_texture(const char *line) {
+int Parse::parse_texture(Cursor c) {
     float s, t;
-    if (2 == sscanf(line, "vt %f %f", &s, &t)) {
+    if (!c.starts_with("vt")) return 0;
+    c.p += 2;
+    if (c.read_float(&s) && c.read_float(&t)) {
     }
     else {
         return 0;
@@ -251,28 +374,29 @@ int Parse::parse_texture(const char *line) {
     return 1;
 }
 
-int Parse::parse_error(const char *line) {
-    fprintf(stderr, "Syntax error: %s\n", line);
+int Parse::parse_error(Cursor c) {
+    fprintf(stderr, "Syntax error: %s\n", c.rest().c_str());
     return 1;
 }
 
-int Parse::parse_smoothing_group(const char *line)
+int Parse::parse_smoothing_group(Cursor c)
 {
-    if (1 == sscanf(line, "s %d", &smoothing_group)) {
-    }
-    else if (line[0] == 's'  && !strcmp(next_token(line), "off")) {
-    }
-    else {
-        return 0;
+    if (!c.peek('s')) return 0;
+    Cursor after = { c.p + 1, c.end };
+    if (after.read_int(&smoothing_group)) {
+        return 1;
     }
-    return 1;
+    c.skip_token();
+    c.skip_space();
+    return c.rest() == "off";
 }
 
-int Parse::parse_use_material(const char *line)
+int Parse::parse_use_material(Cursor c)
 {
-    const char *key = "usemtl";
-    if (!strncmp(line, key, strlen(key))) {
-        const char *mtl_name = next_token(line);
+    if (c.starts_with("usemtl")) {
+        c.skip_token();
+        c.skip_space();
+        const string mtl_name = c.rest();
         material_index = index_of(mtl_name, materials);
         if (material_index < 0) {
             material_index = materials.size();
@@ -285,11 +409,12 @@ int Parse::parse_use_material(const char *line)
     }
 }
 
-int Parse::parse_mtllib(const char *line)
+int Parse::parse_mtllib(Cursor c)
 {
-    const char *key = "mtllib";
-    if (!strncmp(line, key, strlen(key))) {
-        const char *libname = next_token(line);
+    if (c.starts_with("mtllib")) {
+        c.skip_token();
+        c.skip_space();
+        const string libname = c.rest();
 
         if (index_of(libname, mtllibs) < 0) {
             mtllibs.push_back(libname);
@@ -329,20 +454,6 @@ vector<T> deref_triangles(
     return ret;
 }
 
-template<typename T>
-vector<float> to_floats(const vector<T> &inp)
-{
-    vector<float> ret;
-    if (!inp.size()) return ret;
-    glm::length_t len = inp[0].length();
-    for (const auto &x : inp) {
-        for (glm::length_t i = 0; i < len; i++) {
-            ret.push_back(x[i]);
-        }
-    }
-    return ret;
-}
-
 static vec3 hetero(const vec4 &v)
 {
     return vec3(v.x, v.y, v.z) / v.w;
@@ -381,15 +492,6 @@ Handedness Parse::face_handedness(const Face &f)
 }
 */
 
-int Parse::which_corner(const Face &face, int vertex_index) const {
-    for (int i = 0; i < 3; i++) {
-        if (face.vertex_indices[i] == vertex_index) {
-            return i;
-        }
-    }
-    return -1;
-}
-
 vec4 Parse::face_vector(const Face &face, int from, int to) const {
     assert(from >= 0 && from < 3);
     assert(to >= 0 && to < 3);
@@ -399,80 +501,172 @@ vec4 Parse::face_vector(const Face &face, int from, int to) const {
     return tv - fv;
 }
 
-float Parse::angle_at_corner(const Face &face, int vertex_index) const {
-    int origin = which_corner(face, vertex_index);
-    assert(origin >= 0 && origin < 3);
-    int corner_a = -1, corner_b = -1;
-    switch (origin) {
-    case 0: corner_a = 1; corner_b = 2; break;
-    case 1: corner_a = 0; corner_b = 2; break;
-    case 2: corner_a = 0; corner_b = 1; break;
+void Parse::corner_angles(const Face &face, float angles[3]) const {
+    for (int origin = 0; origin < 3; origin++) {
+        vec4 a = face_vector(face, origin, (origin + 1) % 3);
+        vec4 b = face_vector(face, origin, (origin + 2) % 3);
+        angles[origin] = fabs(acos(glm::dot(a, b) /
+                                   (glm::length(a) * glm::length(b))));
     }
+}
 
-    vec4 a = face_vector(face, origin, corner_a);
-    vec4 b = face_vector(face, origin, corner_b);
+// Counting sort of the face corners by vertex. Corners of each vertex stay in
+// face order, so the smoothed sums add up in the same order as they always did.
+void Parse::build_adjacency()
+{
+    vertex_corner_offsets.assign(vertices.size() + 1, 0);
+    for (const Face &face : faces) {
+        for (int i = 0; i < 3; i++) {
+            vertex_corner_offsets.at(face.vertex_indices[i] + 1)++;
+        }
+    }
+    for (size_t v = 0; v < vertices.size(); v++) {
+        vertex_corner_offsets[v + 1] += vertex_corner_offsets[v];
+    }
 
-    return acos(glm::dot(a, b) / (glm::length(a) * glm::length(b)));
+    vertex_corners.resize(3 * faces.size());
+    vector<int> fill(vertex_corner_offsets.begin(),
+                     vertex_corner_offsets.end() - 1);
+    for (size_t f = 0; f < faces.size(); f++) {
+        for (int i = 0; i < 3; i++) {
+            vertex_corners[fill[faces[f].vertex_indices[i]]++] = 3 * f + i;
+        }
+    }
 }
 
-vec3 Parse::smooth_normal(int smoothing_group, int vertex_index) const {
+void Parse::smooth_normals()
+{
+    build_adjacency();
+
     // Weight the normals in proportion to the angle of the face which
     // shares the vertex. This lets the cube have homogenous smoothed
-    // normals regardless of how it's triangulated
-    vec3 sum;
-    const auto face_indices = vert_to_faces.at(vertex_index);
-    assert(face_indices.size() > 0);
-
-    for (int adjacent_index : face_indices) {
-        Face adjacent = faces[adjacent_index];
-        if (smoothing_group == adjacent.smooth) {
-            float angle = fabs(angle_at_corner(adjacent, vertex_index));
-            if (angle > 0) {
-                sum += angle * glm::normalize(face_normal(adjacent));
+    // normals regardless of how it's triangulated. Each face's share of the
+    // corner normals is worked out once, up front.
+    vector<vec3> corner_weights(3 * faces.size(), vec3(0.0f));
+    for (size_t f = 0; f < faces.size(); f++) {
+        const Face &face = faces[f];
+        if (face.smooth <= 0) continue;
+
+        vec3 normal = glm::normalize(face_normal(face));
+        float angles[3];
+        corner_angles(face, angles);
+        for (int i = 0; i < 3; i++) {
+            if (angles[i] > 0) {
+                corner_weights[3 * f + i] = angles[i] * normal;
             }
         }
     }
-    return sum;
-}
 
-void Parse::smooth_face_normals(Face &face) {
-    for (int corner = 0; corner < 3; corner++) {
-        int normal_index = face.normal_indices[corner];
-        if (normal_index < 0 || normal_index >= (int)normals.size()) {
-            int vertex_index = face.vertex_indices[corner];
-            vec3 normal;
-
-            if (face.smooth > 0) {
-                normal = smooth_normal(face.smooth, vertex_index);
+    // New normals go on the end, three per face missing them, in face order
+    const int given = normals.size();
+    for (Face &face : faces) {
+        for (int corner = 0; corner < 3; corner++) {
+            int normal_index = face.normal_indices[corner];
+            if (normal_index < 0 || normal_index >= given) {
+                face.normal_indices[corner] = normals.size();
+                normals.push_back(face.smooth > 0 ? vec3(0.0f) : face_normal(face));
             }
-            else {
-                normal = face_normal(face);
+        }
+    }
+
+    // One sweep over the vertices, summing each smoothing group that meets
+    // there and handing the sums to the corners which needed a normal
+    vector<pair<int, vec3>> sums;
+    for (size_t v = 0; v < vertices.size(); v++) {
+        const int begin = vertex_corner_offsets[v];
+        const int end = vertex_corner_offsets[v + 1];
+
+        sums.clear();
+        for (int k = begin; k < end; k++) {
+            int corner = vertex_corners[k];
+            int group = faces[corner / 3].smooth;
+            if (group <= 0) continue;
+
+            auto it = sums.begin();
+            while (it != sums.end() && it->first != group) it++;
+            if (it == sums.end()) {
+                sums.push_back(make_pair(group, vec3(0.0f)));
+                it = sums.end() - 1;
             }
+            it->second += corner_weights[corner];
+        }
 
-            face.normal_indices[corner] = normals.size();
-            normals.push_back(vec3(normal.x, normal.y, normal.z));
+        for (int k = begin; k < end; k++) {
+            int corner = vertex_corners[k];
+            const Face &face = faces[corner / 3];
+            int normal_index = face.normal_indices[corner % 3];
+            if (face.smooth <= 0 || normal_index < given) continue;
+
+            for (const auto &sum : sums) {
+                if (sum.first == face.smooth) {
+                    normals[normal_index] = sum.second;
+                }
+            }
         }
     }
+
+    for (vec3 &normal : normals) {
+        normal = glm::normalize(normal);
+    }
 }
 
-void Parse::smooth_normals()
-{
-    for (Face &face : faces) {
-        smooth_face_normals(face);
+// Bit patterns of a vertex's position, uv and normal
+typedef std::array<uint32_t, 9> WeldKey;
+
+struct WeldKeyHash {
+    size_t operator()(const WeldKey &key) const
+    {
+        uint64_t h = 14695981039346656037ull;
+        for (uint32_t x : key) {
+            h ^= x;
+            h *= 1099511628211ull;
+        }
+        return h ^ (h >> 32);
     }
+};
 
-    for (vec3 &normal : normals) {
-        normal = glm::normalize(normal);
+// Merges the face corners whose position, uv and normal are bit for bit the
+// same into one vertex, in order of first use. corner_vertex gets the vertex
+// of every corner.
+static void weld(const vector<vec4> &positions,
+                 const vector<vec2> &uvs,
+                 const vector<vec3> &normals,
+                 wf_mesh &mesh,
+                 vector<unsigned> &corner_vertex)
+{
+    std::unordered_map<WeldKey, unsigned, WeldKeyHash> vertices;
+    vertices.reserve(positions.size());
+    corner_vertex.resize(positions.size());
+
+    for (size_t i = 0; i < positions.size(); i++) {
+        WeldKey key = {};
+        memcpy(&key[0], &positions[i].x, 4 * sizeof(float));
+        if (!uvs.empty()) memcpy(&key[4], &uvs[i].x, 2 * sizeof(float));
+        if (!normals.empty()) memcpy(&key[6], &normals[i].x, 3 * sizeof(float));
+
+        auto inserted = vertices.emplace(key, vertices.size());
+        if (inserted.second) {
+            const float *v = reinterpret_cast<const float *>(&key[0]);
+            mesh.vertex4.insert(mesh.vertex4.end(), v, v + 4);
+            if (!uvs.empty()) {
+                mesh.texture2.insert(mesh.texture2.end(), v + 4, v + 6);
+            }
+            if (!normals.empty()) {
+                mesh.normal3.insert(mesh.normal3.end(), v + 6, v + 9);
+            }
+        }
+        corner_vertex[i] = inserted.first->second;
     }
 }
 
-static void groupify(const Parse &parse, map<string, vector<wf_group>> &ret)
+static void groupify(const Parse &parse, const vector<unsigned> &corner_vertex,
+                     map<string, vector<wf_group>> &ret)
 {
     map<pair<string, string>, wf_group> flat;
 
-    // The wf_mesh::vertices array is in face order. The first triangle will
-    // have indices 0,1,2
-    // Each face belongs to exactly one group and has exactly one material.
+    // Corner k of face i is vertex corner_vertex[i*3 + k] of the welded
+    // mesh. Each face belongs to exactly one group and has exactly one
+    // material.
     for (unsigned i = 0; i < parse.faces.size(); i++) {
         const Face &face = parse.faces.at(i);
 
@@ -485,7 +679,7 @@ static void groupify(const Parse &parse, map<string, vector<wf_group>> &ret)
         group.material = mtl_name;
 
         for (int k = 0; k < 3; k++) {
-            group.triangle_indices.push_back(i*3 + k);
+            group.triangle_indices.push_back(corner_vertex[i*3 + k]);
         }
     }
 
@@ -500,20 +694,21 @@ static void groupify(const Parse &parse, map<string, vector<wf_group>> &ret)
 static wf_mesh to_mesh(const Parse &parse)
 {
     wf_mesh ret;
-    ret.vertex4 = to_floats<vec4>(
-        deref_triangles<Face::VERTEX>(
-            parse.faces, parse.vertices));
+    ret.mtllibs = parse.mtllibs;
 
-    ret.texture2 = to_floats<vec2>(
-        deref_triangles<Face::TEXTURE>(
-            parse.faces, parse.textures));
+    const vector<vec4> positions =
+        deref_triangles<Face::VERTEX>(parse.faces, parse.vertices);
+    if (positions.size() != 3 * parse.faces.size()) {
+        return ret;
+    }
 
-    ret.normal3  = to_floats<vec3>(
-        deref_triangles<Face::NORMAL>(
-            parse.faces, parse.normals));
+    vector<unsigned> corner_vertex;
+    weld(positions,
+         deref_triangles<Face::TEXTURE>(parse.faces, parse.textures),
+         deref_triangles<Face::NORMAL>(parse.faces, parse.normals),
+         ret, corner_vertex);
 
-    ret.mtllibs = parse.mtllibs;
-    groupify(parse, ret.groups);
+    groupify(parse, corner_vertex, ret.groups);
     return ret;
 }
 
@@ -542,39 +737,40 @@ void dump_parse(const Parse &parse)
         printf("\n");
     }
 
-    for (const auto &pair : parse.vert_to_faces) {
-        printf("Vertex %d used by faces:", pair.first);
-        for (const auto &index : pair.second) {
-            printf(" %d", index);
+    for (size_t v = 0; v + 1 < parse.vertex_corner_offsets.size(); v++) {
+        printf("Vertex %zu used by faces:", v);
+        for (int k = parse.vertex_corner_offsets[v];
+             k < parse.vertex_corner_offsets[v + 1]; k++) {
+            printf(" %d", parse.vertex_corners[k] / 3);
         }
         printf("\n");
     }
 }
 
-static Parse parse_objfile(FILE *fp)
+static Parse parse_objfile(const char *data, size_t size)
 {
     Parse parse;
-    char buf[2048];
+    const char *end = data + size;
 
-    while (fgets(buf, sizeof(buf), fp)) {
-        strip_right(buf);
-        const char *line = strip_left(buf);
+    for (const char *line = data; line < end; ) {
+        const char *newline = (const char *)memchr(line, '\n', end - line);
+        Cursor c = { line, newline ? newline : end };
+        line = newline ? newline + 1 : end;
 
-        if (!*line || *line == '#' || *line == '\n') {
+        skip_blank(c);
+        if (c.at_end() || *c.p == '#') {
             continue;
         }
 
-        assert(
-            parse.parse_mtllib(line) ||
-            parse.parse_use_material(line) ||
-            parse.parse_smoothing_group(line) ||
-            parse.parse_group(line) ||
-            parse.parse_vertex(line) ||
-            parse.parse_normal(line) ||
-            parse.parse_texture(line) ||
-            parse.parse_face(line) ||
-            parse.parse_error(line)
-        );
+        parse.parse_mtllib(c) ||
+        parse.parse_use_material(c) ||
+        parse.parse_smoothing_group(c) ||
+        parse.parse_group(c) ||
+        parse.parse_vertex(c) ||
+        parse.parse_normal(c) ||
+        parse.parse_texture(c) ||
+        parse.parse_face(c) ||
+        parse.parse_error(c);
     }
 
     parse.smooth_normals();
@@ -619,35 +815,50 @@ void dump_mesh(const wf_mesh &o)
 
 struct wf_mesh wf_mesh_from_file(const char *path)
 {
-    FILE* fp = fopen(path, "r");
-    if (!fp) {
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) < 0) {
         perror(path);
+        if (fd >= 0) close(fd);
         return wf_mesh();
     }
+    if (st.st_size == 0) {
+        close(fd);
+        return to_mesh(parse_objfile("", 0));
+    }
 
-    return to_mesh(parse_objfile(fp));
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        perror(path);
+        return wf_mesh();
+    }
+    madvise(map, st.st_size, MADV_SEQUENTIAL);
+
+    wf_mesh ret = to_mesh(parse_objfile((const char *)map, st.st_size));
+    munmap(map, st.st_size);
+    return ret;
 }
 
 std::vector<Triangle> wf_triangles_from_file(const char *path)
 {
-    FILE* fp = fopen(path, "r");
-    if (!fp) {
-        perror(path);
-        return {};
-    }
+    return wf_triangles(wf_mesh_view::of(wf_mesh_from_file(path)));
+}
 
+std::vector<Triangle> wf_triangles(const wf_mesh_view &mesh)
+{
     std::vector<Triangle> ret;
-    Parse parse = parse_objfile(fp);
-    std::vector<glm::vec4> derefed = deref_triangles<Face::VERTEX>(
-            parse.faces, parse.vertices);
-    size_t count = derefed.size();
-
-    for (size_t i = 0; i + 2 < count; i += 3) {
-        Triangle triangle;
-        for (int k = 0; k < 3; k++) {
-            triangle.vertices[k] = glm::vec3(derefed[i + k] / derefed[i + k].w);;
+    for (const auto &group : mesh.groups) {
+        for (size_t i = 0; i + 2 < group.count; i += 3) {
+            Triangle triangle;
+            for (int k = 0; k < 3; k++) {
+                size_t index = group.triangle_indices[i + k];
+                assert(4 * index + 3 < mesh.vertex4_count);
+                const float *v = &mesh.vertex4[4 * index];
+                triangle.vertices[k] = glm::vec3(v[0], v[1], v[2]) / v[3];
+            }
+            ret.push_back(triangle);
         }
-        ret.push_back(triangle);
     }
     return ret;
 }
@@ -662,10 +873,87 @@ bool wf_mesh::has_normals() const
     return normal3.size() / 3 >= vertex4.size() / 4;
 }
 
+bool wf_mesh_view::has_texture_coords() const
+{
+    return texture2_count / 2 >= vertex4_count / 4;
+}
+
+bool wf_mesh_view::has_normals() const
+{
+    return normal3_count / 3 >= vertex4_count / 4;
+}
+
+wf_mesh_view wf_mesh_view::of(const wf_mesh &mesh)
+{
+    wf_mesh_view ret;
+    ret.vertex4 = mesh.vertex4.data();
+    ret.vertex4_count = mesh.vertex4.size();
+    ret.texture2 = mesh.texture2.data();
+    ret.texture2_count = mesh.texture2.size();
+    ret.normal3 = mesh.normal3.data();
+    ret.normal3_count = mesh.normal3.size();
+    for (const auto &pair : mesh.groups) {
+        for (const wf_group &group : pair.second) {
+            ret.groups.push_back({
+                pair.first, group.material,
+                group.triangle_indices.data(), group.triangle_indices.size()
+            });
+        }
+    }
+    return ret;
+}
+
+// The nearest half float to a uv coordinate that's in the same whole number
+// interval. The shader takes fract() of uvs, so the 0.9999s that keep
+// textures off their edges mustn't round up to 1.
+static uint16_t pack_uv(float x)
+{
+    uint16_t h = glm::packHalf1x16(x);
+    float y = glm::unpackHalf1x16(h);
+    if (std::floor(y) != std::floor(x)) {
+        // Only rounding up can cross, since whole numbers are exact. Step
+        // one half float back towards minus infinity.
+        h = y > 0 ? h - 1 : (h | 0x8000) + 1;
+    }
+    return h;
+}
+
+std::vector<wf_packed_vertex> wf_pack_vertices(const wf_mesh_view &mesh)
+{
+    static_assert(sizeof(wf_packed_vertex) == 20,
+                  "wf_packed_vertex isn't packed");
+    const bool has_normals = mesh.has_normals();
+    const bool has_uvs = mesh.has_texture_coords();
+    std::vector<wf_packed_vertex> ret(mesh.vertex4_count / 4);
+    for (size_t i = 0; i < ret.size(); i++) {
+        wf_packed_vertex &vertex = ret[i];
+        const float *v = &mesh.vertex4[4 * i];
+        vertex.position = vec3(v[0], v[1], v[2]) / v[3];
+
+        vertex.normal = 0;
+        if (has_normals) {
+            const float *n = &mesh.normal3[3 * i];
+            vertex.normal = glm::packSnorm3x10_1x2(vec4(n[0], n[1], n[2], 0));
+        }
+
+        vertex.uv[0] = vertex.uv[1] = 0;
+        if (has_uvs) {
+            vertex.uv[0] = pack_uv(mesh.texture2[2 * i]);
+            vertex.uv[1] = pack_uv(mesh.texture2[2 * i + 1]);
+        }
+    }
+    return ret;
+}
+
 #ifdef TEST
 int main()
 {
-    Parse p = parse_objfile(stdin);
+    string input;
+    char buf[1 << 16];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), stdin)) > 0) input.append(buf, n);
+
+    Parse p = parse_objfile(input.data(), input.size());
     wf_mesh o = to_mesh(p);
 
     dump_parse(p);
@@ -1,4 +1,5 @@
 #pragma once
+#include <cstdint>
 #include <vector>
 #include <map>
 #include <string>
@@ -28,6 +29,43 @@ struct Triangle {
     glm::vec3 vertices[3];
 };
 
+/* One vertex interleaved into the 20 bytes gl3_mesh draws from. The position
+ * drops w, which the attribute fills back in as 1. The normal is
+ * GL_INT_2_10_10_10_REV and the uv two half floats. Missing normals or uvs are
+ * left zero, which is what the shader would read with their attributes
+ * disabled. It lives here so the mesh cache can hold vertices ready to upload. */
+struct wf_packed_vertex {
+    glm::vec3 position;
+    uint32_t normal;
+    uint16_t uv[2];
+};
+
+/* The arrays of a wf_mesh without owning them, so a mesh can be used straight
+ * out of a mapped cache file. Counts are in floats and indices. */
+struct wf_mesh_view {
+    struct group {
+        std::string name;
+        std::string material;
+        const unsigned *triangle_indices;
+        size_t count;
+    };
+
+    const float *vertex4 = NULL, *texture2 = NULL, *normal3 = NULL;
+    size_t vertex4_count = 0, texture2_count = 0, normal3_count = 0;
+    std::vector<group> groups;
+    // The vertices already packed, one per four vertex4 floats, when they
+    // come from the cache. NULL otherwise.
+    const wf_packed_vertex *packed = NULL;
+
+    bool has_texture_coords() const;
+    bool has_normals() const;
+
+    static wf_mesh_view of(const wf_mesh &);
+};
+
 struct wf_mesh wf_mesh_from_file(const char *path);
 std::vector<Triangle> wf_triangles_from_file(const char *path);
+// Every triangle of the mesh, group by group
+std::vector<Triangle> wf_triangles(const wf_mesh_view &);
+std::vector<wf_packed_vertex> wf_pack_vertices(const wf_mesh_view &);
 void dump_mesh(const wf_mesh &);
@@ -0,0 +1,268 @@
+#include "wavefront_cache.hpp"
+#include "wavefront_optimize.hpp"
+
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+extern "C" {
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+}
+
+// Bump this whenever the file layout or the parser's output changes
+#define OBJ_CACHE_VERSION 4
+#define OBJ_CACHE_MAGIC "OBJC"
+#define OBJ_CACHE_NAME_SIZE 64
+
+/* Layout: header, group records, the packed vertices, then the vertex4,
+ * normal3 and texture2 floats and the groups' indices. Everything is made of
+ * 4 byte values so every array is aligned in the mapping. The floats are
+ * still kept for picking and anything else that reads the mesh. */
+struct ObjCacheHeader {
+    char magic[4];
+    uint32_t version;
+    uint64_t source_size;
+    int64_t source_mtime_sec;
+    int64_t source_mtime_nsec;
+    uint64_t source_hash;
+    uint32_t vertex4_count;
+    uint32_t normal3_count;
+    uint32_t texture2_count;
+    uint32_t group_count;
+    // Whether wf_optimize() was run on the mesh
+    uint32_t optimized;
+};
+
+struct ObjCacheGroup {
+    char name[OBJ_CACHE_NAME_SIZE];
+    char material[OBJ_CACHE_NAME_SIZE];
+    // Offset in indices from the start of all the groups' indices
+    uint32_t first;
+    uint32_t count;
+};
+
+// FNV-1a
+static uint64_t hash_bytes(uint64_t h, const void *data, size_t n)
+{
+    const uint8_t *p = (const uint8_t *)data;
+    for (size_t i = 0; i < n; i++) {
+        h ^= p[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+static uint64_t hash_file(const char *path)
+{
+    uint64_t h = 14695981039346656037ULL;
+    FILE *fp = fopen(path, "rb");
+    if (!fp) return h;
+    char buf[1 << 16];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), fp)) > 0) {
+        h = hash_bytes(h, buf, n);
+    }
+    fclose(fp);
+    return h;
+}
+
+static struct timespec mtime_of(const struct stat &st)
+{
+#ifdef __APPLE__
+    return st.st_mtimespec;
+#else
+    return st.st_mtim;
+#endif
+}
+
+wf_cached_mesh::wf_cached_mesh(const char *obj_path, bool _optimize)
+    : optimize(_optimize)
+{
+    memset(&source, 0, sizeof(source));
+    struct stat st;
+    if (stat(obj_path, &st) < 0) {
+        // Let the parser report it, and don't cache a missing file
+        parsed = wf_mesh_from_file(obj_path);
+        mesh = wf_mesh_view::of(parsed);
+        return;
+    }
+    source.size = st.st_size;
+    const struct timespec mtime = mtime_of(st);
+    source.mtime_sec = mtime.tv_sec;
+    source.mtime_nsec = mtime.tv_nsec;
+
+    const std::string path = std::string(obj_path) + "c";
+    if (load(path)) return;
+
+    parsed = wf_mesh_from_file(obj_path);
+    if (optimize) {
+        wf_cache_stats before = wf_analyze_vertex_cache(parsed);
+        wf_optimize(parsed);
+        wf_cache_stats after = wf_analyze_vertex_cache(parsed);
+        fprintf(stderr, "%s: ACMR %.3f -> %.3f, ATVR %.3f -> %.3f\n",
+                obj_path, before.acmr, after.acmr, before.atvr, after.atvr);
+    }
+    mesh = wf_mesh_view::of(parsed);
+    packed = wf_pack_vertices(mesh);
+    mesh.packed = packed.data();
+    source.hash = hash_file(obj_path);
+    save(path);
+}
+
+wf_cached_mesh::~wf_cached_mesh()
+{
+    if (map) munmap(map, map_size);
+}
+
+bool wf_cached_mesh::load(const std::string &path)
+{
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+
+    struct stat st;
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(ObjCacheHeader)) {
+        close(fd);
+        return false;
+    }
+    size_t size = st.st_size;
+    void *p = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) return false;
+
+    const ObjCacheHeader *header = (const ObjCacheHeader *)p;
+    const ObjCacheGroup *groups = (const ObjCacheGroup *)(header + 1);
+    bool ok = !memcmp(header->magic, OBJ_CACHE_MAGIC, 4) &&
+              header->version == OBJ_CACHE_VERSION &&
+              header->source_size == source.size &&
+              header->vertex4_count % 4 == 0 &&
+              header->optimized == optimize;
+    source.hash = header->source_hash;
+    bool touched = ok && (header->source_mtime_sec != source.mtime_sec ||
+                          header->source_mtime_nsec != source.mtime_nsec);
+    if (touched) {
+        // Touched, say by a checkout, but maybe not changed
+        source.hash = hash_file(path.substr(0, path.size() - 1).c_str());
+        ok = header->source_hash == source.hash;
+    }
+
+    size_t index_count = 0;
+    size_t expected = sizeof(ObjCacheHeader);
+    if (ok) {
+        expected += header->group_count * sizeof(ObjCacheGroup);
+        ok = expected <= size;
+    }
+    for (uint32_t i = 0; ok && i < header->group_count; i++) {
+        index_count += groups[i].count;
+    }
+    // The counts adding up isn't enough, every group has to lie within them
+    for (uint32_t i = 0; ok && i < header->group_count; i++) {
+        ok = (size_t)groups[i].first + groups[i].count <= index_count;
+    }
+    if (ok) {
+        expected += sizeof(wf_packed_vertex) * (header->vertex4_count / 4);
+        expected += sizeof(float) * ((size_t)header->vertex4_count +
+                                     header->normal3_count +
+                                     header->texture2_count);
+        expected += sizeof(uint32_t) * index_count;
+        ok = expected == size;
+    }
+    if (!ok) {
+        munmap(p, size);
+        return false;
+    }
+
+    map = p;
+    map_size = size;
+    mesh.packed = (const wf_packed_vertex *)(groups + header->group_count);
+    mesh.vertex4 = (const float *)(mesh.packed + header->vertex4_count / 4);
+    mesh.vertex4_count = header->vertex4_count;
+    mesh.normal3 = mesh.vertex4 + mesh.vertex4_count;
+    mesh.normal3_count = header->normal3_count;
+    mesh.texture2 = mesh.normal3 + mesh.normal3_count;
+    mesh.texture2_count = header->texture2_count;
+    const unsigned *indices =
+        (const unsigned *)(mesh.texture2 + mesh.texture2_count);
+    for (uint32_t i = 0; i < header->group_count; i++) {
+        const ObjCacheGroup &group = groups[i];
+        mesh.groups.push_back({
+            std::string(group.name, strnlen(group.name, OBJ_CACHE_NAME_SIZE)),
+            std::string(group.material,
+                        strnlen(group.material, OBJ_CACHE_NAME_SIZE)),
+            indices + group.first, group.count
+        });
+    }
+
+    // Record the new mtime so the next run can skip hashing
+    if (touched) save(path);
+    return true;
+}
+
+void wf_cached_mesh::save(const std::string &path) const
+{
+    ObjCacheHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, OBJ_CACHE_MAGIC, 4);
+    header.version = OBJ_CACHE_VERSION;
+    header.source_size = source.size;
+    header.source_mtime_sec = source.mtime_sec;
+    header.source_mtime_nsec = source.mtime_nsec;
+    header.source_hash = source.hash;
+    header.vertex4_count = mesh.vertex4_count;
+    header.normal3_count = mesh.normal3_count;
+    header.texture2_count = mesh.texture2_count;
+    header.group_count = mesh.groups.size();
+    header.optimized = optimize;
+
+    std::vector<ObjCacheGroup> groups(mesh.groups.size());
+    uint32_t first = 0;
+    for (size_t i = 0; i < mesh.groups.size(); i++) {
+        const wf_mesh_view::group &group = mesh.groups[i];
+        if (group.name.size() > OBJ_CACHE_NAME_SIZE ||
+            group.material.size() > OBJ_CACHE_NAME_SIZE) {
+            fprintf(stderr, "%s: names too long to cache\n", path.c_str());
+            return;
+        }
+        memset(&groups[i], 0, sizeof(groups[i]));
+        memcpy(groups[i].name, group.name.data(), group.name.size());
+        memcpy(groups[i].material, group.material.data(),
+               group.material.size());
+        groups[i].first = first;
+        groups[i].count = group.count;
+        first += group.count;
+    }
+
+    // Write then rename so a reader never maps a half written cache
+    const std::string tmp_path = path + ".tmp";
+    FILE *fp = fopen(tmp_path.c_str(), "wb");
+    if (!fp) {
+        perror(tmp_path.c_str());
+        return;
+    }
+
+    bool ok = fwrite(&header, sizeof(header), 1, fp) == 1 &&
+              fwrite(groups.data(), sizeof(ObjCacheGroup), groups.size(), fp)
+                  == groups.size() &&
+              fwrite(mesh.packed, sizeof(wf_packed_vertex),
+                     mesh.vertex4_count / 4, fp) == mesh.vertex4_count / 4 &&
+              fwrite(mesh.vertex4, sizeof(float), mesh.vertex4_count, fp)
+                  == mesh.vertex4_count &&
+              fwrite(mesh.normal3, sizeof(float), mesh.normal3_count, fp)
+                  == mesh.normal3_count &&
+              fwrite(mesh.texture2, sizeof(float), mesh.texture2_count, fp)
+                  == mesh.texture2_count;
+    for (const wf_mesh_view::group &group : mesh.groups) {
+        ok = ok && fwrite(group.triangle_indices, sizeof(unsigned),
+                          group.count, fp) == group.count;
+    }
+    ok = !fclose(fp) && ok;
+    if (ok && rename(tmp_path.c_str(), path.c_str()) < 0) {
+        perror(path.c_str());
+        ok = false;
+    }
+    if (!ok) {
+        unlink(tmp_path.c_str());
+    }
+}
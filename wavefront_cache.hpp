@@ -0,0 +1,43 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+#include "wavefront.hpp"
+
+/* A mesh read from the binary cache foo.objc next to foo.obj. The cache holds
+ * the flattened vertex arrays and group indices that wf_mesh_from_file()
+ * would produce, passed through wf_optimize() unless asked not to, along with
+ * the vertices already packed for drawing. It's mapped and used in place.
+ * It's trusted when its header matches the .obj's size and mtime, or failing
+ * that the hash of its contents. Otherwise the .obj is parsed and the cache
+ * rewritten.
+ */
+class wf_cached_mesh {
+public:
+    explicit wf_cached_mesh(const char *obj_path, bool optimize = true);
+    ~wf_cached_mesh();
+    wf_cached_mesh(const wf_cached_mesh &) = delete;
+    wf_cached_mesh &operator=(const wf_cached_mesh &) = delete;
+
+    // Valid for as long as this object is
+    const wf_mesh_view &view() const { return mesh; }
+
+private:
+    bool load(const std::string &path);
+    void save(const std::string &path) const;
+
+    bool optimize;
+    // Only filled when the cache couldn't be used
+    wf_mesh parsed;
+    std::vector<wf_packed_vertex> packed;
+    void *map = NULL;
+    size_t map_size = 0;
+    wf_mesh_view mesh;
+
+    struct {
+        uint64_t size;
+        int64_t mtime_sec, mtime_nsec;
+        uint64_t hash;
+    } source;
+};
@@ -0,0 +1,316 @@
+#include "wavefront_optimize.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <climits>
+#include <numeric>
+#include <vector>
+
+// Entries in the modelled post-transform cache
+#define VERTEX_CACHE_SIZE 16
+// How much worse than the ACMR of its whole cluster a run of triangles may be
+// and still be split off to be sorted for overdraw on its own
+#define OVERDRAW_THRESHOLD 1.05f
+
+using std::vector;
+
+namespace {
+
+// FIFO cache of VERTEX_CACHE_SIZE vertices, kept as the time each vertex last
+// went in. A vertex is cached if fewer than VERTEX_CACHE_SIZE have gone in
+// since.
+struct CacheModel {
+    vector<unsigned> time_in;
+    unsigned time = VERTEX_CACHE_SIZE + 1;
+
+    explicit CacheModel(size_t vertex_count) : time_in(vertex_count, 0) {}
+
+    bool cached(unsigned v) const
+    {
+        return time - time_in[v] <= VERTEX_CACHE_SIZE;
+    }
+
+    // Returns whether it missed
+    bool use(unsigned v)
+    {
+        if (cached(v)) return false;
+        time_in[v] = time++;
+        return true;
+    }
+
+    unsigned use_triangle(const unsigned *t)
+    {
+        return use(t[0]) + use(t[1]) + use(t[2]);
+    }
+
+    void flush() { time += VERTEX_CACHE_SIZE + 1; }
+};
+
+// Triangles using each vertex, in compressed rows: the triangles using v are
+// triangles[offsets[v]..offsets[v+1]]
+struct Adjacency {
+    vector<unsigned> offsets;
+    vector<unsigned> triangles;
+
+    Adjacency(const vector<unsigned> &indices, size_t vertex_count)
+        : offsets(vertex_count + 1, 0), triangles(indices.size())
+    {
+        for (unsigned v : indices) offsets[v + 1]++;
+        for (size_t v = 0; v < vertex_count; v++) {
+            offsets[v + 1] += offsets[v];
+        }
+        vector<unsigned> fill(offsets.begin(), offsets.end() - 1);
+        for (size_t i = 0; i < indices.size(); i++) {
+            triangles[fill[indices[i]]++] = i / 3;
+        }
+    }
+};
+
+// Tipsify, from Sander, Nehab and Barczak, "Fast Triangle Reordering for
+// Vertex Locality and Reduced Overdraw", 2007. Emits the remaining triangles
+// around one vertex at a time, then moves to a vertex of those triangles that
+// will still be cached once its own fan is drawn. When none is, the walk
+// restarts from a recently used vertex or the next unused one, which starts a
+// new cluster. Returns the reordered indices, and the first triangle of each
+// cluster in clusters.
+vector<unsigned> tipsify(const vector<unsigned> &indices, size_t vertex_count,
+                         vector<size_t> &clusters)
+{
+    const Adjacency adjacency(indices, vertex_count);
+    vector<unsigned> live(vertex_count);
+    for (size_t v = 0; v < vertex_count; v++) {
+        live[v] = adjacency.offsets[v + 1] - adjacency.offsets[v];
+    }
+    vector<bool> emitted(indices.size() / 3, false);
+    CacheModel cache(vertex_count);
+    vector<unsigned> dead_ends;
+    vector<unsigned> candidates;
+    size_t cursor = 0;
+
+    vector<unsigned> ret;
+    ret.reserve(indices.size());
+    clusters.clear();
+    if (!indices.empty()) clusters.push_back(0);
+    long fan = indices.empty() ? -1 : indices[0];
+    while (fan >= 0) {
+        candidates.clear();
+        for (unsigned k = adjacency.offsets[fan];
+             k < adjacency.offsets[fan + 1]; k++) {
+            unsigned t = adjacency.triangles[k];
+            if (emitted[t]) continue;
+            emitted[t] = true;
+            for (int i = 0; i < 3; i++) {
+                unsigned v = indices[3 * t + i];
+                ret.push_back(v);
+                dead_ends.push_back(v);
+                candidates.push_back(v);
+                live[v]--;
+                cache.use(v);
+            }
+        }
+
+        // Prefer the vertex that went into the cache longest ago, as long
+        // as it'll still be there after its fan. Vertices that won't are
+        // only picked when nothing else is left.
+        fan = -1;
+        long best = -1;
+        for (unsigned v : candidates) {
+            if (!live[v]) continue;
+            long age = cache.time - cache.time_in[v];
+            long priority = age + 2 * live[v] <= VERTEX_CACHE_SIZE ? age : 0;
+            if (priority > best) {
+                best = priority;
+                fan = v;
+            }
+        }
+        if (fan >= 0) continue;
+
+        while (fan < 0 && !dead_ends.empty()) {
+            unsigned v = dead_ends.back();
+            dead_ends.pop_back();
+            if (live[v]) fan = v;
+        }
+        while (fan < 0 && cursor < vertex_count) {
+            if (live[cursor]) fan = cursor;
+            cursor++;
+        }
+        if (fan >= 0 && clusters.back() != ret.size() / 3) {
+            clusters.push_back(ret.size() / 3);
+        }
+    }
+    return ret;
+}
+
+// Splits each cluster further wherever the triangles so far, drawn from a
+// cold cache, already come within OVERDRAW_THRESHOLD of the whole cluster's
+// ACMR. Each run then loses little by being moved somewhere else.
+vector<size_t> split_clusters(const vector<unsigned> &indices,
+                              const vector<size_t> &clusters,
+                              size_t vertex_count)
+{
+    CacheModel cache(vertex_count);
+    vector<size_t> ret;
+    const size_t triangle_count = indices.size() / 3;
+    for (size_t c = 0; c < clusters.size(); c++) {
+        const size_t begin = clusters[c];
+        const size_t end = c + 1 < clusters.size() ? clusters[c + 1]
+                                                   : triangle_count;
+        cache.flush();
+        unsigned misses = 0;
+        for (size_t t = begin; t < end; t++) {
+            misses += cache.use_triangle(&indices[3 * t]);
+        }
+        const float threshold = OVERDRAW_THRESHOLD * misses / (end - begin);
+
+        ret.push_back(begin);
+        cache.flush();
+        unsigned run_misses = 0, run_triangles = 0;
+        for (size_t t = begin; t + 1 < end; t++) {
+            run_misses += cache.use_triangle(&indices[3 * t]);
+            run_triangles++;
+            if (run_misses <= threshold * run_triangles) {
+                ret.push_back(t + 1);
+                cache.flush();
+                run_misses = 0;
+                run_triangles = 0;
+            }
+        }
+    }
+    return ret;
+}
+
+// Draws the clusters facing furthest out from the middle of the mesh first,
+// since from most directions they're in front of the rest
+vector<unsigned> sort_for_overdraw(const vector<unsigned> &indices,
+                                   const vector<size_t> &clusters,
+                                   const vector<glm::vec3> &positions)
+{
+    glm::vec3 middle(0.0f);
+    for (unsigned v : indices) middle += positions[v];
+    if (!indices.empty()) middle /= (float)indices.size();
+
+    const size_t triangle_count = indices.size() / 3;
+    vector<float> facing(clusters.size());
+    for (size_t c = 0; c < clusters.size(); c++) {
+        const size_t end = c + 1 < clusters.size() ? clusters[c + 1]
+                                                   : triangle_count;
+        glm::vec3 centroid(0.0f), normal(0.0f);
+        float area = 0;
+        for (size_t t = clusters[c]; t < end; t++) {
+            const glm::vec3 &p0 = positions[indices[3 * t]];
+            const glm::vec3 &p1 = positions[indices[3 * t + 1]];
+            const glm::vec3 &p2 = positions[indices[3 * t + 2]];
+            glm::vec3 n = glm::cross(p1 - p0, p2 - p0);
+            float twice_area = glm::length(n);
+            centroid += (p0 + p1 + p2) * (twice_area / 3);
+            normal += n;
+            area += twice_area;
+        }
+        float length = glm::length(normal);
+        facing[c] = area > 0 && length > 0 ?
+                    glm::dot(centroid / area - middle, normal / length) : 0;
+    }
+
+    vector<size_t> order(clusters.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+        return facing[a] > facing[b];
+    });
+
+    vector<unsigned> ret;
+    ret.reserve(indices.size());
+    for (size_t c : order) {
+        const size_t end = c + 1 < clusters.size() ? clusters[c + 1]
+                                                   : triangle_count;
+        ret.insert(ret.end(), indices.begin() + 3 * clusters[c],
+                   indices.begin() + 3 * end);
+    }
+    return ret;
+}
+
+void permute(vector<float> &values, size_t width,
+             const vector<unsigned> &remap, size_t used)
+{
+    if (values.empty()) return;
+    assert(values.size() == width * remap.size());
+    vector<float> ret(width * used);
+    for (size_t v = 0; v < remap.size(); v++) {
+        if (remap[v] == UINT_MAX) continue;
+        std::copy(values.begin() + width * v, values.begin() + width * (v + 1),
+                  ret.begin() + width * remap[v]);
+    }
+    values.swap(ret);
+}
+
+// Renumbers vertices in order of first use, so the vertex fetches walk
+// through the arrays instead of jumping around them
+void optimize_vertex_fetch(wf_mesh &mesh)
+{
+    vector<unsigned> remap(mesh.vertex4.size() / 4, UINT_MAX);
+    unsigned used = 0;
+    for (auto &pair : mesh.groups) {
+        for (wf_group &group : pair.second) {
+            for (unsigned &index : group.triangle_indices) {
+                if (remap[index] == UINT_MAX) remap[index] = used++;
+                index = remap[index];
+            }
+        }
+    }
+
+    permute(mesh.vertex4, 4, remap, used);
+    permute(mesh.texture2, 2, remap, used);
+    permute(mesh.normal3, 3, remap, used);
+}
+
+}
+
+wf_cache_stats wf_analyze_vertex_cache(const wf_mesh &mesh)
+{
+    const size_t vertex_count = mesh.vertex4.size() / 4;
+    CacheModel cache(vertex_count);
+    vector<bool> used(vertex_count, false);
+    size_t misses = 0, triangles = 0, vertices = 0;
+    for (const auto &pair : mesh.groups) {
+        for (const wf_group &group : pair.second) {
+            // Every group is its own draw call
+            cache.flush();
+            const vector<unsigned> &indices = group.triangle_indices;
+            for (size_t i = 0; i + 2 < indices.size(); i += 3) {
+                misses += cache.use_triangle(&indices[i]);
+                triangles++;
+            }
+            for (unsigned v : indices) {
+                vertices += !used[v];
+                used[v] = true;
+            }
+        }
+    }
+
+    wf_cache_stats ret;
+    ret.acmr = triangles ? (float)misses / triangles : 0;
+    ret.atvr = vertices ? (float)misses / vertices : 0;
+    return ret;
+}
+
+void wf_optimize(wf_mesh &mesh)
+{
+    const size_t vertex_count = mesh.vertex4.size() / 4;
+    vector<glm::vec3> positions(vertex_count);
+    for (size_t v = 0; v < vertex_count; v++) {
+        const float *p = &mesh.vertex4[4 * v];
+        positions[v] = glm::vec3(p[0], p[1], p[2]) / p[3];
+    }
+
+    for (auto &pair : mesh.groups) {
+        for (wf_group &group : pair.second) {
+            vector<size_t> clusters;
+            const vector<unsigned> ordered =
+                tipsify(group.triangle_indices, vertex_count, clusters);
+            clusters = split_clusters(ordered, clusters, vertex_count);
+            group.triangle_indices =
+                sort_for_overdraw(ordered, clusters, positions);
+        }
+    }
+
+    optimize_vertex_fetch(mesh);
+}
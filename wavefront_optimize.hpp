@@ -0,0 +1,21 @@
+#pragma once
+
+#include "wavefront.hpp"
+
+/* Post-transform vertex cache behaviour of a mesh whose groups are drawn one
+ * after another through a FIFO cache: average misses per triangle (ACMR, 0.5
+ * at best for a big regular grid, 3 at worst) and per vertex used (ATVR, 1 at
+ * best). */
+struct wf_cache_stats {
+    float acmr;
+    float atvr;
+};
+
+wf_cache_stats wf_analyze_vertex_cache(const wf_mesh &);
+
+/* Reorders each group's triangles for the vertex cache, then sorts runs of
+ * them so the ones facing out from the middle of the mesh are drawn first,
+ * to cut overdraw. Finally renumbers the vertices in the order the groups
+ * first use them, dropping any that aren't used. The same triangles are
+ * drawn with the same winding, only in a different order. */
+void wf_optimize(wf_mesh &);